@@ -0,0 +1,170 @@
+// 两个协程之间的乒乓：每次往返包含两次挂起/唤醒，用于比较调度路径上的开销（引用计数、锁、原子操作）
+// channel：通过无缓冲Channel传递；socket：通过socketpair读写，走hook的EAGAIN -> addEvent -> epoll唤醒路径
+// 用perf_event_open统计整个进程（包括之后创建的调度线程）的计数器，虚拟机等不支持的计数器显示为n/a
+// 用法：./bench_pingpong [channel|socket] [往返次数]
+#include "ioscheduler.h"
+#include "hook.h"
+#include "channel.h"
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+
+struct Counter
+{
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+    int fd;
+};
+
+// inherit：之后创建的线程也计入，线程退出后合并到这里读取的值中
+static int open_counter(uint32_t type, uint64_t config)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static bool is_intel()
+{
+    std::ifstream ifs("/proc/cpuinfo");
+    std::string line;
+    while(std::getline(ifs, line))
+    {
+        if(line.compare(0, 9, "vendor_id") == 0)
+        {
+            return line.find("GenuineIntel") != std::string::npos;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char** argv)
+{
+    bool socket_mode = argc > 1 && strcmp(argv[1], "socket") == 0;
+    long rounds = argc > 2 ? atol(argv[2]) : 200000;
+
+    Counter counters[] =
+    {
+        {"task-clock ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, -1},
+        {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1},
+        {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1},
+        // MEM_INST_RETIRED.LOCK_LOADS：带lock前缀的指令（原子读改写），Skylake及之后的Intel处理器
+        {"lock loads", PERF_TYPE_RAW, 0x21d0, -1},
+        {"context switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, -1}
+    };
+    // 进程只有一个线程时libstdc++的shared_ptr使用非原子的引用计数，与实际的多线程服务不符
+    // 创建过线程之后glibc不再把进程当作单线程
+    std::thread([]() {}).join();
+
+    bool intel = is_intel();
+    for(Counter& c : counters)
+    {
+        if(c.type != PERF_TYPE_RAW || intel)
+        {
+            c.fd = open_counter(c.type, c.config);
+        }
+    }
+
+    long sum = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for(Counter& c : counters)
+    {
+        if(c.fd >= 0)
+        {
+            ioctl(c.fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    {
+        sylar::IOManager iom(1);
+        if(socket_mode)
+        {
+            iom.scheduleLock([&]()
+            {
+                int fds[2];
+                socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+                iom.scheduleLock([&, fds]()
+                {
+                    char c;
+                    for(long i = 0; i < rounds; i++)
+                    {
+                        read(fds[1], &c, 1);
+                        write(fds[1], &c, 1);
+                    }
+                });
+                for(long i = 0; i < rounds; i++)
+                {
+                    char c = (char)i;
+                    write(fds[0], &c, 1);
+                    read(fds[0], &c, 1);
+                    sum += (unsigned char)c;
+                }
+                close(fds[0]);
+                close(fds[1]);
+            });
+        }
+        else
+        {
+            sylar::Channel<long> ping(0), pong(0);
+            iom.scheduleLock([&]()
+            {
+                for(long i = 0; i < rounds; i++)
+                {
+                    long v;
+                    ping.send(i);
+                    pong.recv(v);
+                    sum += v;
+                }
+            });
+            iom.scheduleLock([&]()
+            {
+                for(long i = 0; i < rounds; i++)
+                {
+                    long v;
+                    ping.recv(v);
+                    pong.send(v);
+                }
+            });
+        }
+    }
+    for(Counter& c : counters)
+    {
+        if(c.fd >= 0)
+        {
+            ioctl(c.fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+
+    printf("%s ping-pong, %ld round trips (sum=%ld)\n", socket_mode ? "socket" : "channel", rounds, sum);
+    printf("%-18s %12.1f\n", "wall ns", ns / rounds);
+    for(Counter& c : counters)
+    {
+        uint64_t value;
+        if(c.fd >= 0 && read(c.fd, &value, sizeof(value)) == sizeof(value))
+        {
+            printf("%-18s %12.1f\n", c.name, (double)value / rounds);
+        }
+        else
+        {
+            printf("%-18s %12s\n", c.name, "n/a");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,175 @@
+// 静态文件发送的对比：read+send、sendfile、MSG_ZEROCOPY
+// 同一进程内通过回环TCP连接把文件发送给服务端协程，统计吞吐量和每GB消耗的CPU时间（用户态+内核态，收发两端合计）
+// 用法：./bench_sendfile [文件大小MB] [轮数]
+#include "ioscheduler.h"
+#include "hook.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+static const size_t CHUNK = 256 * 1024;
+
+enum Mode
+{
+    READ_SEND,
+    SENDFILE,
+    ZEROCOPY
+};
+
+static const char* mode_name(Mode mode)
+{
+    return mode == READ_SEND ? "read+send" : (mode == SENDFILE ? "sendfile" : "MSG_ZEROCOPY");
+}
+
+static double cpu_seconds()
+{
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+// 把整个文件发送到sock，返回发送的字节数
+static long send_file(Mode mode, int sock, int file, size_t size, std::vector<char>& buf)
+{
+    long total = 0;
+    if(mode == SENDFILE)
+    {
+        off_t off = 0;
+        while((size_t)off < size)
+        {
+            ssize_t n = sendfile(sock, file, &off, size - off);
+            if(n <= 0)
+            {
+                perror("sendfile");
+                break;
+            }
+            total += n;
+        }
+        return total;
+    }
+
+    int flags = mode == ZEROCOPY ? MSG_ZEROCOPY : 0;
+    off_t off = 0;
+    while((size_t)off < size)
+    {
+        ssize_t n = pread(file, buf.data(), buf.size(), off);
+        if(n <= 0)
+        {
+            break;
+        }
+        off += n;
+        // hook后的send会等到MSG_ZEROCOPY完成通知再返回，缓冲区可以立即重用
+        for(ssize_t sent = 0; sent < n; )
+        {
+            ssize_t m = send(sock, buf.data() + sent, n - sent, flags);
+            if(m <= 0)
+            {
+                perror("send");
+                return total;
+            }
+            sent += m;
+            total += m;
+        }
+    }
+    return total;
+}
+
+int main(int argc, char** argv)
+{
+    size_t size = (argc > 1 ? atol(argv[1]) : 64) << 20;
+    int rounds = argc > 2 ? atoi(argv[2]) : 8;
+
+    char path[] = "/tmp/bench_sendfile_XXXXXX";
+    int file = mkstemp(path);
+    if(file < 0)
+    {
+        perror("mkstemp");
+        return 1;
+    }
+    unlink(path);
+    {
+        std::vector<char> block(1 << 20, 'x');
+        for(size_t i = 0; i < size; i += block.size())
+        {
+            if(write(file, block.data(), block.size()) != (ssize_t)block.size())
+            {
+                perror("write");
+                return 1;
+            }
+        }
+    }
+
+    printf("file %zu MB x %d rounds over loopback TCP\n", size >> 20, rounds);
+    printf("%-14s %10s %14s\n", "mode", "MB/s", "cpu ms per GB");
+
+    sylar::IOManager iom(2);
+    iom.scheduleLock([&]()
+    {
+        int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(listen_fd, (sockaddr*)&addr, sizeof(addr));
+        listen(listen_fd, 16);
+        socklen_t len = sizeof(addr);
+        getsockname(listen_fd, (sockaddr*)&addr, &len);
+
+        for(Mode mode : {READ_SEND, SENDFILE, ZEROCOPY})
+        {
+            // 服务端：读取并丢弃，直到对端关闭
+            iom.scheduleLock([listen_fd]()
+            {
+                int fd = accept(listen_fd, nullptr, nullptr);
+                std::vector<char> buf(CHUNK);
+                while(read(fd, buf.data(), buf.size()) > 0)
+                {
+                }
+                close(fd);
+            });
+
+            int sock = socket(AF_INET, SOCK_STREAM, 0);
+            if(connect(sock, (sockaddr*)&addr, sizeof(addr)) != 0)
+            {
+                perror("connect");
+                return;
+            }
+            if(mode == ZEROCOPY)
+            {
+                int one = 1;
+                if(setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) != 0)
+                {
+                    perror("SO_ZEROCOPY");
+                }
+            }
+
+            std::vector<char> buf(CHUNK);
+            long total = 0;
+            double cpu0 = cpu_seconds();
+            auto t0 = std::chrono::steady_clock::now();
+            for(int r = 0; r < rounds; r++)
+            {
+                total += send_file(mode, sock, file, size, buf);
+            }
+            close(sock);
+            double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            double cpu = cpu_seconds() - cpu0;
+            printf("%-14s %10.0f %14.1f\n", mode_name(mode), total / secs / (1 << 20), cpu * 1e3 / (total / 1e9));
+        }
+        close(listen_fd);
+    });
+    return 0;
+}
@@ -0,0 +1,164 @@
+// 无栈协程Task<T>与有栈协程的对比：
+// 1. 阻塞在Channel上的空闲等待者每个占用的内存（协程帧 vs 协程栈）
+// 2. 两个无缓冲Channel上的乒乓往返时间
+// 需要-std=c++20（task.h在C++17下为空）
+// 调用线程只在IOManager析构时参与调度，主线程负责启动、等待和统计 -> 线程数至少为2
+// 用法：./bench_task [等待者个数] [往返次数] [线程数]
+#include "task.h"
+#include "channel.h"
+#include "hook.h"
+#include <malloc.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#ifndef __cpp_impl_coroutine
+#error "bench_task needs -std=c++20"
+#endif
+
+// 已分配的堆内存，包括超过mmap阈值、单独映射的协程栈
+static size_t heap_bytes()
+{
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+}
+
+static sylar::Task<void> task_waiter(sylar::Channel<int>& ch, std::atomic<long>& parked)
+{
+    int v;
+    parked++;
+    co_await sylar::recv_from(ch, v);
+    parked--;
+}
+
+static sylar::Task<void> task_ping(sylar::Channel<long>& ping, sylar::Channel<long>& pong, long rounds, std::atomic<bool>& done)
+{
+    for(long i = 0; i < rounds; i++)
+    {
+        long v;
+        co_await sylar::send_to(ping, i);
+        co_await sylar::recv_from(pong, v);
+    }
+    done = true;
+}
+
+static sylar::Task<void> task_pong(sylar::Channel<long>& ping, sylar::Channel<long>& pong, long rounds)
+{
+    for(long i = 0; i < rounds; i++)
+    {
+        long v;
+        co_await sylar::recv_from(ping, v);
+        co_await sylar::send_to(pong, v);
+    }
+}
+
+// 主线程等待：之前的IOManager在主线程上运行过调度，hook仍处于开启状态 -> 关闭，否则usleep会尝试挂起主协程
+static void wait_until(const std::atomic<bool>& flag)
+{
+    sylar::set_hook_enable(false);
+    while(!flag.load())
+    {
+        usleep(1000);
+    }
+}
+
+// 启动waiters个等待者，全部挂起后统计堆内存的增长，然后关闭Channel让它们结束
+static double waiter_bytes(bool task, long waiters, int threads)
+{
+    sylar::set_hook_enable(false);
+    sylar::Channel<int> ch(0);
+    std::atomic<long> parked{0};
+    sylar::IOManager iom(threads);
+    // 先让调度线程完成启动时的分配
+    usleep(100000);
+    size_t before = heap_bytes();
+    for(long i = 0; i < waiters; i++)
+    {
+        if(task)
+        {
+            sylar::co_spawn(&iom, task_waiter(ch, parked));
+        }
+        else
+        {
+            iom.scheduleLock([&ch, &parked]()
+            {
+                int v;
+                parked++;
+                ch.recv(v);
+                parked--;
+            });
+        }
+    }
+    while(parked.load() < waiters)
+    {
+        usleep(10000);
+    }
+    // 最后一个等待者从计数到挂起之间
+    usleep(100000);
+    size_t after = heap_bytes();
+    iom.scheduleLock([&ch]() {ch.close();});
+    // 等待者结束之后再析构IOManager：停止时已空闲的线程才能收到唤醒
+    while(parked.load() > 0)
+    {
+        usleep(1000);
+    }
+    return (double)(after - before) / waiters;
+}
+
+// 只统计往返本身，不包括IOManager的启动和停止
+static double pingpong_ns(bool task, long rounds, int threads)
+{
+    sylar::Channel<long> ping(0), pong(0);
+    std::atomic<bool> done{false};
+    sylar::IOManager iom(threads);
+    auto t0 = std::chrono::steady_clock::now();
+    if(task)
+    {
+        sylar::co_spawn(&iom, task_ping(ping, pong, rounds, done));
+        sylar::co_spawn(&iom, task_pong(ping, pong, rounds));
+    }
+    else
+    {
+        iom.scheduleLock([&]()
+        {
+            for(long i = 0; i < rounds; i++)
+            {
+                long v;
+                ping.send(i);
+                pong.recv(v);
+            }
+            done = true;
+        });
+        iom.scheduleLock([&]()
+        {
+            for(long i = 0; i < rounds; i++)
+            {
+                long v;
+                ping.recv(v);
+                pong.send(v);
+            }
+        });
+    }
+    wait_until(done);
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / rounds;
+}
+
+int main(int argc, char** argv)
+{
+    long waiters = argc > 1 ? atol(argv[1]) : 10000;
+    long rounds = argc > 2 ? atol(argv[2]) : 200000;
+    int threads = std::max(2, argc > 3 ? atoi(argv[3]) : 2);
+
+    printf("%d threads, %ld idle waiters, %ld round trips\n", threads, waiters, rounds);
+    printf("%-8s %16s %16s\n", "", "bytes/waiter", "ns/round trip");
+    for(bool task : {true, false})
+    {
+        double bytes = waiter_bytes(task, waiters, threads);
+        double ns = pingpong_ns(task, rounds, threads);
+        printf("%-8s %16.0f %16.1f\n", task ? "Task" : "Fiber", bytes, ns);
+    }
+    return 0;
+}
@@ -0,0 +1,161 @@
+// 回环UDP的每秒包数对比：逐个recvfrom/sendto、UdpSocket批量（recvmmsg/sendmmsg）、UdpSocket+GSO/GRO
+// 发送协程和接收协程在同一个单线程IOManager中，发送方最多领先接收方WINDOW个数据报（然后让出线程），避免接收缓冲区溢出丢包
+// 用法：./bench_udp [数据报个数] [数据报大小]
+#include "ioscheduler.h"
+#include "hook.h"
+#include "udp_socket.h"
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static const int BATCH = 64;
+static const long WINDOW = 256;
+
+enum Mode
+{
+    SINGLE,
+    BATCHED,
+    GSO_GRO
+};
+
+static const char* mode_name(Mode mode)
+{
+    return mode == SINGLE ? "recvfrom/sendto" : (mode == BATCHED ? "recvmmsg/sendmmsg" : "sendmmsg+GSO/GRO");
+}
+
+static double cpu_seconds()
+{
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+    long count = argc > 1 ? atol(argv[1]) : 1000000;
+    size_t size = argc > 2 ? atol(argv[2]) : 64;
+
+    printf("%ld datagrams of %zu bytes over loopback UDP\n", count, size);
+    printf("%-18s %12s %14s %10s\n", "mode", "packets/s", "cpu ns/packet", "lost");
+
+    for(Mode mode : {SINGLE, BATCHED, GSO_GRO})
+    {
+        std::atomic<long> received{0};
+        std::atomic<bool> done{false};
+        double cpu0 = cpu_seconds();
+        auto t0 = std::chrono::steady_clock::now();
+        {
+            sylar::IOManager iom(1);
+            // 接收方：在协程中创建socket（由hook设为非阻塞），直到发送方结束且没有在途的数据报（等待超时）
+            iom.scheduleLock([&]()
+            {
+                sylar::UdpSocket rx(AF_INET, BATCH, mode == GSO_GRO ? 65535 : 2048);
+                sockaddr_in addr{};
+                addr.sin_family = AF_INET;
+                addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                rx.bind((sockaddr*)&addr, sizeof(addr));
+                socklen_t len = sizeof(addr);
+                getsockname(rx.getFd(), (sockaddr*)&addr, &len);
+                if(mode == GSO_GRO)
+                {
+                    rx.enableGro();
+                }
+                timeval tv{0, 100000};
+                setsockopt(rx.getFd(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+                // 受net.core.rmem_max限制
+                int rcvbuf = 4 << 20;
+                setsockopt(rx.getFd(), SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+                iom.scheduleLock([&, addr]()
+                {
+                    sylar::UdpSocket tx(AF_INET, BATCH);
+                    if(mode == GSO_GRO)
+                    {
+                        tx.setGsoSize(size);
+                    }
+                    std::vector<char> payload(size * BATCH, 'u');
+                    std::vector<sylar::UdpSocket::Datagram> datagrams(BATCH);
+                    for(auto& d : datagrams)
+                    {
+                        d = {payload.data(), size, (const sockaddr*)&addr, sizeof(addr)};
+                    }
+
+                    // UDP_SEGMENT一次最多64个分段，总长度不超过64KB
+                    long per_send = mode == GSO_GRO ? std::max(1L, std::min((long)BATCH, (long)(65000 / size))) : BATCH;
+                    for(long sent = 0; sent < count; )
+                    {
+                        // 丢包时接收方永远追不上 -> 超过100ms没有进展就不再等待
+                        auto since = std::chrono::steady_clock::now();
+                        long last = received.load(std::memory_order_relaxed);
+                        while(sent - last >= WINDOW && std::chrono::steady_clock::now() - since < std::chrono::milliseconds(100))
+                        {
+                            // 经过一次idle：epoll_wait取出接收方的读事件（yieldNow()只在任务队列中轮转）
+                            usleep(0);
+                            long cur = received.load(std::memory_order_relaxed);
+                            if(cur != last)
+                            {
+                                last = cur;
+                                since = std::chrono::steady_clock::now();
+                            }
+                        }
+                        long n = std::min(per_send, count - sent);
+                        if(mode == SINGLE)
+                        {
+                            for(long i = 0; i < n; i++)
+                            {
+                                sendto(tx.getFd(), payload.data(), size, 0, (const sockaddr*)&addr, sizeof(addr));
+                            }
+                        }
+                        else if(mode == BATCHED)
+                        {
+                            tx.send(datagrams.data(), n);
+                        }
+                        else
+                        {
+                            // 一个缓冲区由内核切分为n个数据报
+                            sylar::UdpSocket::Datagram d{payload.data(), size * n, (const sockaddr*)&addr, sizeof(addr)};
+                            tx.send(&d, 1);
+                        }
+                        sent += n;
+                    }
+                    done = true;
+                });
+
+                std::vector<char> buf(65535);
+                std::vector<sylar::UdpSocket::Datagram> datagrams;
+                while(received.load(std::memory_order_relaxed) < count)
+                {
+                    int n;
+                    if(mode == SINGLE)
+                    {
+                        n = recvfrom(rx.getFd(), buf.data(), buf.size(), 0, nullptr, nullptr) > 0 ? 1 : -1;
+                    }
+                    else
+                    {
+                        n = rx.recv(datagrams);
+                    }
+                    if(n <= 0)
+                    {
+                        if(done.load())
+                        {
+                            break;
+                        }
+                        continue;
+                    }
+                    received.fetch_add(n, std::memory_order_relaxed);
+                }
+            });
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        double cpu = cpu_seconds() - cpu0;
+        long got = received.load();
+        printf("%-18s %12.0f %14.0f %10ld\n", mode_name(mode), got / secs, cpu * 1e9 / (got ? got : 1), count - got);
+    }
+    return 0;
+}
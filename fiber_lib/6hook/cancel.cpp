@@ -0,0 +1,199 @@
+#include "cancel.h"
+#include "fiber.h"
+#include "hook.h"
+#include "ioscheduler.h"
+
+#include <chrono>
+
+namespace sylar {
+
+CancelToken::CancelToken(std::shared_ptr<CancelToken> parent):
+m_parent(parent)
+{
+	if(m_parent)
+	{
+		m_deadline = m_parent->m_deadline;
+		m_parentHook.fn = &CancelToken::OnParentCancel;
+		m_parentHook.arg = this;
+		m_linked = m_parent->enter(&m_parentHook);
+		if(!m_linked)
+		{
+			// 父令牌已经被取消
+			cancel(m_parent->getError());
+		}
+	}
+}
+
+CancelToken::~CancelToken()
+{
+	if(m_timer)
+	{
+		m_timer->cancel();
+	}
+	if(m_linked)
+	{
+		m_parent->leave(&m_parentHook);
+	}
+}
+
+bool CancelToken::enter(CancelHook* hook)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(isCancelled())
+	{
+		return false;
+	}
+	hook->prev = nullptr;
+	hook->next = m_head;
+	if(m_head)
+	{
+		m_head->prev = hook;
+	}
+	m_head = hook;
+	return true;
+}
+
+void CancelToken::leave(CancelHook* hook)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(hook->prev)
+	{
+		hook->prev->next = hook->next;
+	}
+	else if(m_head == hook)
+	{
+		m_head = hook->next;
+	}
+	else
+	{
+		// 不在链表中
+		return;
+	}
+	if(hook->next)
+	{
+		hook->next->prev = hook->prev;
+	}
+	hook->prev = hook->next = nullptr;
+}
+
+void CancelToken::cancel(int error)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(isCancelled())
+	{
+		return;
+	}
+	m_error = error;
+	m_cancelled.store(true, std::memory_order_release);
+	for(CancelHook* h = m_head; h; h = h->next)
+	{
+		h->fn(h->arg);
+	}
+}
+
+void CancelToken::setDeadline(IOManager* iom, uint64_t ms)
+{
+	uint64_t deadline = NowMs() + ms;
+	if(deadline >= m_deadline)
+	{
+		// 父令牌的截止时间更早，它到期时会取消本令牌
+		return;
+	}
+	m_deadline = deadline;
+
+	if(m_timer)
+	{
+		m_timer->cancel();
+	}
+	std::weak_ptr<CancelToken> weak = shared_from_this();
+	m_timer = iom->addTimer(ms, [weak]()
+	{
+		if(std::shared_ptr<CancelToken> token = weak.lock())
+		{
+			token->cancel(ETIMEDOUT);
+		}
+	});
+}
+
+void CancelToken::OnParentCancel(void* arg)
+{
+	CancelToken* self = (CancelToken*)arg;
+	// 在父令牌的cancel()中调用，父令牌的m_error已经设置
+	self->cancel(self->m_parent->m_error);
+}
+
+CancelToken* CancelToken::GetThis()
+{
+	if(!is_hook_enable())
+	{
+		return nullptr;
+	}
+	return Fiber::GetCancelToken();
+}
+
+bool CancelToken::IsCancelled()
+{
+	CancelToken* token = GetThis();
+	return token && token->isCancelled();
+}
+
+int CancelToken::GetError()
+{
+	CancelToken* token = GetThis();
+	return token ? token->getError() : 0;
+}
+
+bool CancelToken::DeadlineWithin(uint64_t ms)
+{
+	CancelToken* token = GetThis();
+	return token && token->m_deadline != NO_DEADLINE && token->m_deadline <= NowMs() + ms;
+}
+
+uint64_t CancelToken::NowMs()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+CancelScopeHook::CancelScopeHook(void (*fn)(void*), void* arg):
+m_token(CancelToken::GetThis())
+{
+	if(m_token)
+	{
+		m_hook.fn = fn;
+		m_hook.arg = arg;
+		m_entered = m_token->enter(&m_hook);
+	}
+}
+
+CancelScopeHook::~CancelScopeHook()
+{
+	if(m_entered)
+	{
+		m_token->leave(&m_hook);
+	}
+}
+
+DeadlineScope::DeadlineScope(uint64_t ms)
+{
+	IOManager* iom = IOManager::GetThis();
+	if(!is_hook_enable() || !iom)
+	{
+		return;
+	}
+
+	m_prev = Fiber::GetCancelToken();
+	m_token = std::make_shared<CancelToken>(m_prev ? m_prev->shared_from_this() : nullptr);
+	m_token->setDeadline(iom, ms);
+	Fiber::Current()->setCancelToken(m_token.get());
+}
+
+DeadlineScope::~DeadlineScope()
+{
+	if(m_token)
+	{
+		Fiber::Current()->setCancelToken(m_prev);
+	}
+}
+
+}
@@ -0,0 +1,132 @@
+#ifndef _CANCEL_H_
+#define _CANCEL_H_
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <cerrno>
+
+namespace sylar {
+
+class Timer;
+class IOManager;
+
+// 一次可取消的阻塞等待，位于等待协程的栈上
+// 取消时调用fn(arg)唤醒等待者（如IOManager::cancelEvent），等待者醒来后检查令牌并返回令牌的错误码
+// 用函数指针而不是std::function -> 每次IO等待注册时不需要分配内存
+struct CancelHook
+{
+	void (*fn)(void*) = nullptr;
+	void* arg = nullptr;
+	CancelHook* prev = nullptr;
+	CancelHook* next = nullptr;
+};
+
+// 取消令牌：设置到协程上（Fiber::setCancelToken），hook的阻塞调用在等待期间注册CancelHook
+// 令牌可以有父令牌：父令牌取消时子令牌以相同的错误码一起取消，子令牌继承父令牌的截止时间
+// 由TaskGroup（ECANCELED）和DeadlineScope（ETIMEDOUT）创建，总是由shared_ptr管理
+class CancelToken : public std::enable_shared_from_this<CancelToken>
+{
+public:
+	static const uint64_t NO_DEADLINE = ~0ull;
+
+	explicit CancelToken(std::shared_ptr<CancelToken> parent = nullptr);
+	~CancelToken();
+
+	CancelToken(const CancelToken&) = delete;
+	CancelToken& operator=(const CancelToken&) = delete;
+
+	bool isCancelled() const {return m_cancelled.load(std::memory_order_acquire);}
+	// 取消的原因，未取消时为0
+	int getError() const {return isCancelled() ? m_error : 0;}
+
+	// 注册阻塞等待，已经取消时不注册并返回false
+	bool enter(CancelHook* hook);
+	void leave(CancelHook* hook);
+
+	// 设置取消标志并调用所有已注册等待的fn，只有第一次调用有效
+	void cancel(int error = ECANCELED);
+
+	// 在iom中添加一个定时器，ms毫秒后以ETIMEDOUT取消；只能缩短已有的截止时间
+	void setDeadline(IOManager* iom, uint64_t ms);
+	// 绝对截止时间（steady_clock毫秒），没有时为NO_DEADLINE
+	uint64_t getDeadline() const {return m_deadline;}
+
+public:
+	// 当前协程的取消令牌，不在hook协程中时返回nullptr
+	static CancelToken* GetThis();
+	// 当前协程是否已被取消
+	static bool IsCancelled();
+	// 当前协程被取消的原因，未取消时为0
+	static int GetError();
+	// 当前协程在ms毫秒内是否会到达截止时间 -> 此时不需要再为单次调用添加超时定时器
+	static bool DeadlineWithin(uint64_t ms);
+
+	// steady_clock的当前毫秒数
+	static uint64_t NowMs();
+
+private:
+	static void OnParentCancel(void* arg);
+
+private:
+	std::atomic<bool> m_cancelled = {false};
+	int m_error = 0;
+	uint64_t m_deadline = NO_DEADLINE;
+	std::shared_ptr<Timer> m_timer;
+
+	std::shared_ptr<CancelToken> m_parent;
+	CancelHook m_parentHook;
+	bool m_linked = false;
+
+	// 保护等待链表；cancel()持锁调用fn，保证fn执行期间等待者不会离开
+	std::mutex m_mutex;
+	CancelHook* m_head = nullptr;
+};
+
+// 在当前协程的取消令牌上注册一次等待，析构时注销
+class CancelScopeHook
+{
+public:
+	CancelScopeHook(void (*fn)(void*), void* arg);
+	~CancelScopeHook();
+
+	// 是否注册成功，注册前已经被取消时返回false
+	bool entered() const {return m_entered;}
+	CancelToken* token() const {return m_token;}
+
+private:
+	CancelToken* m_token;
+	CancelHook m_hook;
+	bool m_entered = false;
+};
+
+// 协程级的截止时间：作用域内所有hook的阻塞调用（read/write/connect/accept/poll/sleep等）
+// 到期后被唤醒并返回ETIMEDOUT，之后再发起的阻塞调用立即失败
+// 整个作用域只使用一个定时器；嵌套时取最早的截止时间；作用域内spawn的协程继承截止时间
+// 只在IOManager的协程中生效
+//
+// {
+//     sylar::DeadlineScope d(50);
+//     read(fd, buf, len);  // 最多等待50ms
+// }
+class DeadlineScope
+{
+public:
+	explicit DeadlineScope(uint64_t ms);
+	~DeadlineScope();
+
+	DeadlineScope(const DeadlineScope&) = delete;
+	DeadlineScope& operator=(const DeadlineScope&) = delete;
+
+	// 是否已经到期（或外层被取消）
+	bool expired() const {return m_token && m_token->isCancelled();}
+
+private:
+	std::shared_ptr<CancelToken> m_token;
+	// 进入作用域前协程的令牌，退出时恢复
+	CancelToken* m_prev = nullptr;
+};
+
+}
+
+#endif
@@ -0,0 +1,295 @@
+#ifndef _CHANNEL_H_
+#define _CHANNEL_H_
+
+#include <deque>
+#include <limits>
+#include <optional>
+
+#include "fiber_sync.h"
+
+namespace sylar {
+
+class Selector;
+
+// Go风格的通道：在协程之间传递数据，发送/接收在无法立即完成时挂起协程而不是阻塞线程
+// capacity == 0: 无缓冲通道，发送者一直挂起到有接收者取走数据
+// capacity == UNBOUNDED: 无界通道，发送永远不会挂起
+// 有等待的接收者时，发送者直接把数据写入接收者的变量并唤醒它，不经过缓冲区
+// 无缓冲通道上配对成功后，当前协程下一次挂起时直接切换到对端协程（FiberWaiter::handoff）
+template<class T>
+class Channel
+{
+public:
+	static const size_t UNBOUNDED = std::numeric_limits<size_t>::max();
+
+	enum Status
+	{
+		OK = 0,
+		// 通道已关闭（接收时表示已关闭且缓冲区已取空）
+		CLOSED,
+		// try操作无法立即完成
+		WOULD_BLOCK,
+		TIMEOUT
+	};
+
+	explicit Channel(size_t capacity = 0): m_capacity(capacity) {}
+
+	Channel(const Channel&) = delete;
+	Channel& operator=(const Channel&) = delete;
+
+	// 通道关闭时返回false
+	bool send(T value) {return doSend(value, WAIT_FOREVER) == OK;}
+	Status trySend(T value) {return doSend(value, 0);}
+	Status sendFor(T value, uint64_t timeout_ms) {return doSend(value, timeout_ms);}
+
+	// 通道关闭且没有剩余数据时返回false
+	bool recv(T& value) {return doRecv(value, WAIT_FOREVER) == OK;}
+	Status tryRecv(T& value) {return doRecv(value, 0);}
+	Status recvFor(T& value, uint64_t timeout_ms) {return doRecv(value, timeout_ms);}
+
+	// 关闭通道：唤醒所有等待者，之后的发送都会失败，缓冲区中的数据仍然可以被接收
+	void close()
+	{
+		WaitList waiters;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if(m_closed)
+			{
+				return;
+			}
+			m_closed = true;
+			while(FiberWaiter* w = m_recvWaiters.pop_claimed())
+			{
+				waiters.push_back(w);
+			}
+			while(FiberWaiter* w = m_sendWaiters.pop_claimed())
+			{
+				waiters.push_back(w);
+			}
+		}
+		while(FiberWaiter* w = waiters.pop_front())
+		{
+			w->ok = false;
+			w->wake();
+		}
+	}
+
+	bool isClosed()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_closed;
+	}
+
+	size_t size()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_queue.size();
+	}
+
+	size_t capacity() const {return m_capacity;}
+
+	// 等待者及其数据：发送者指向待发送的值，接收者指向接收的变量
+	struct Waiter : public FiberWaiter
+	{
+		using FiberWaiter::FiberWaiter;
+		T* slot = nullptr;
+	};
+
+	// 供不能挂起的等待者（无栈协程，见task.h）使用：能立即完成时返回OK或CLOSED
+	// 否则把w加入等待队列并返回WOULD_BLOCK，之后由对端传递数据（或close()）并调用w.wake()，完成后w.ok为true
+	Status sendOrEnqueue(T& value, Waiter& w)
+	{
+		Waiter* peer;
+		Status st;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			st = sendLocked(value, peer);
+			if(st == WOULD_BLOCK)
+			{
+				w.slot = &value;
+				m_sendWaiters.push_back(&w);
+				return st;
+			}
+		}
+		if(peer)
+		{
+			wakePeer(peer);
+		}
+		return st;
+	}
+
+	Status recvOrEnqueue(T& value, Waiter& w)
+	{
+		Waiter* peer;
+		Status st;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			st = recvLocked(value, peer);
+			if(st == WOULD_BLOCK)
+			{
+				w.slot = &value;
+				m_recvWaiters.push_back(&w);
+				return st;
+			}
+		}
+		if(peer)
+		{
+			wakePeer(peer);
+		}
+		return st;
+	}
+
+private:
+	friend class Selector;
+
+	static const uint64_t WAIT_FOREVER = ~0ull;
+
+	// 以下两个函数需持有m_mutex：尝试立即完成发送/接收，返回OK、CLOSED或WOULD_BLOCK
+	// 与之配对的等待者通过peer返回，由调用者在释放锁后唤醒
+	Status sendLocked(T& value, Waiter*& peer)
+	{
+		peer = nullptr;
+		if(m_closed)
+		{
+			return CLOSED;
+		}
+
+		// 快速路径1：有等待的接收者 -> 直接交给它
+		if((peer = static_cast<Waiter*>(m_recvWaiters.pop_claimed())))
+		{
+			*peer->slot = std::move(value);
+			peer->ok = true;
+			return OK;
+		}
+
+		// 快速路径2：缓冲区未满
+		if(m_queue.size() < m_capacity)
+		{
+			m_queue.push_back(std::move(value));
+			return OK;
+		}
+		return WOULD_BLOCK;
+	}
+
+	Status recvLocked(T& value, Waiter*& peer)
+	{
+		// 快速路径1：缓冲区有数据，同时把一个等待的发送者的数据补进缓冲区
+		if(!m_queue.empty())
+		{
+			value = std::move(m_queue.front());
+			m_queue.pop_front();
+			if((peer = static_cast<Waiter*>(m_sendWaiters.pop_claimed())))
+			{
+				m_queue.push_back(std::move(*peer->slot));
+				peer->ok = true;
+			}
+			return OK;
+		}
+
+		// 快速路径2：无缓冲通道上等待的发送者
+		if((peer = static_cast<Waiter*>(m_sendWaiters.pop_claimed())))
+		{
+			value = std::move(*peer->slot);
+			peer->ok = true;
+			return OK;
+		}
+		return m_closed ? CLOSED : WOULD_BLOCK;
+	}
+
+	// timeout_ms == 0: 不挂起，WAIT_FOREVER: 一直等待
+	// 快速路径上不构造等待者，只有需要挂起时才记录当前协程
+	Status doSend(T& value, uint64_t timeout_ms)
+	{
+		std::optional<Waiter> w;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			Waiter* peer;
+			Status st = sendLocked(value, peer);
+			if(st != WOULD_BLOCK || timeout_ms == 0)
+			{
+				lock.unlock();
+				if(peer)
+				{
+					wakePeer(peer);
+				}
+				return st;
+			}
+
+			w.emplace();
+			w->slot = &value;
+			m_sendWaiters.push_back(&*w);
+		}
+
+		if(!park(*w, timeout_ms, m_sendWaiters))
+		{
+			return TIMEOUT;
+		}
+		// 被接收者取走数据，或者通道被关闭
+		return w->ok ? OK : CLOSED;
+	}
+
+	Status doRecv(T& value, uint64_t timeout_ms)
+	{
+		std::optional<Waiter> w;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			Waiter* peer;
+			Status st = recvLocked(value, peer);
+			if(st != WOULD_BLOCK || timeout_ms == 0)
+			{
+				lock.unlock();
+				if(peer)
+				{
+					wakePeer(peer);
+				}
+				return st;
+			}
+
+			w.emplace();
+			w->slot = &value;
+			m_recvWaiters.push_back(&*w);
+		}
+
+		if(!park(*w, timeout_ms, m_recvWaiters))
+		{
+			return TIMEOUT;
+		}
+		return w->ok ? OK : CLOSED;
+	}
+
+	void wakePeer(Waiter* peer)
+	{
+		if(m_capacity == 0)
+		{
+			peer->handoff();
+		}
+		else
+		{
+			peer->wake();
+		}
+	}
+
+	// 超时返回false
+	bool park(Waiter& w, uint64_t timeout_ms, WaitList& list)
+	{
+		if(timeout_ms == WAIT_FOREVER)
+		{
+			w.park();
+			return true;
+		}
+		return w.park(timeout_ms, m_mutex, list);
+	}
+
+private:
+	const size_t m_capacity;
+	// 保护以下所有成员，临界区内不会挂起
+	std::mutex m_mutex;
+	std::deque<T> m_queue;
+	bool m_closed = false;
+	WaitList m_sendWaiters;
+	WaitList m_recvWaiters;
+};
+
+}
+
+#endif
@@ -0,0 +1,635 @@
+#include "dns.h"
+#include "hook.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <algorithm>
+#include <cstring>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+static bool debug = false;
+
+namespace sylar {
+
+static const char* RESOLV_CONF = "/etc/resolv.conf";
+static const char* HOSTS_FILE  = "/etc/hosts";
+
+// DNS报文常量 RFC 1035
+static const uint16_t DNS_TYPE_A    = 1;
+static const uint16_t DNS_TYPE_SOA  = 6;
+static const uint16_t DNS_TYPE_AAAA = 28;
+static const uint16_t DNS_CLASS_IN  = 1;
+static const size_t   DNS_HEADER_SIZE = 12;
+static const size_t   DNS_MAX_UDP = 512;
+static const size_t   MAX_CACHE_SIZE = 4096;
+
+DnsResolver* DnsResolver::GetInstance()
+{
+	static DnsResolver* s_resolver = new DnsResolver();
+	return s_resolver;
+}
+
+DnsResolver::DnsResolver()
+{
+}
+
+static std::string to_lower(std::string s)
+{
+	std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c){ return std::tolower(c); });
+	return s;
+}
+
+static bool parse_address(const std::string& s, DnsResolver::Address& addr)
+{
+	if(inet_pton(AF_INET, s.c_str(), addr.addr) == 1)
+	{
+		addr.family = AF_INET;
+		return true;
+	}
+	if(inet_pton(AF_INET6, s.c_str(), addr.addr) == 1)
+	{
+		addr.family = AF_INET6;
+		return true;
+	}
+	return false;
+}
+
+// 文件修改时间，文件不存在时返回-1
+static time_t file_mtime(const char* path)
+{
+	struct stat st;
+	if(stat(path, &st) == -1)
+	{
+		return -1;
+	}
+	return st.st_mtime;
+}
+
+std::vector<DnsResolver::Server> DnsResolver::ParseServers(const std::vector<std::string>& servers, uint16_t port)
+{
+	std::vector<Server> result;
+	for(auto& i : servers)
+	{
+		Address addr;
+		if(!parse_address(i, addr))
+		{
+			std::cerr << "DnsResolver: invalid nameserver address: " << i << std::endl;
+			continue;
+		}
+
+		Server server;
+		memset(&server.addr, 0, sizeof(server.addr));
+		if(addr.family == AF_INET)
+		{
+			sockaddr_in* sin = (sockaddr_in*)&server.addr;
+			sin->sin_family = AF_INET;
+			sin->sin_port = htons(port);
+			memcpy(&sin->sin_addr, addr.addr, sizeof(sin->sin_addr));
+			server.len = sizeof(sockaddr_in);
+		}
+		else
+		{
+			sockaddr_in6* sin6 = (sockaddr_in6*)&server.addr;
+			sin6->sin6_family = AF_INET6;
+			sin6->sin6_port = htons(port);
+			memcpy(&sin6->sin6_addr, addr.addr, sizeof(sin6->sin6_addr));
+			server.len = sizeof(sockaddr_in6);
+		}
+		result.push_back(server);
+	}
+	return result;
+}
+
+void DnsResolver::setServers(const std::vector<std::string>& servers, uint16_t port)
+{
+	std::vector<Server> result = ParseServers(servers, port);
+
+	std::lock_guard<std::mutex> lock(m_confMutex);
+	m_servers.swap(result);
+	m_manualServers = !m_servers.empty();
+}
+
+void DnsResolver::setTimeout(uint64_t ms)
+{
+	std::lock_guard<std::mutex> lock(m_confMutex);
+	m_timeout = ms;
+	m_manualOptions = true;
+}
+
+void DnsResolver::setAttempts(int attempts)
+{
+	std::lock_guard<std::mutex> lock(m_confMutex);
+	m_attempts = std::max(attempts, 1);
+	m_manualOptions = true;
+}
+
+void DnsResolver::clearCache()
+{
+	std::unique_lock<std::shared_mutex> write_lock(m_cacheMutex);
+	m_cache.clear();
+}
+
+// no lock
+void DnsResolver::loadConfig()
+{
+	time_t mtime = file_mtime(RESOLV_CONF);
+	if(mtime == m_confMtime && !m_servers.empty())
+	{
+		return;
+	}
+	m_confMtime = mtime;
+
+	std::vector<std::string> servers;
+	m_search.clear();
+	std::ifstream in(RESOLV_CONF);
+	std::string line;
+	while(std::getline(in, line))
+	{
+		std::istringstream ss(line);
+		std::string key;
+		if(!(ss >> key) || key[0] == '#' || key[0] == ';')
+		{
+			continue;
+		}
+
+		std::string value;
+		if(key == "nameserver" && (ss >> value))
+		{
+			servers.push_back(value);
+		}
+		else if(key == "search" || key == "domain")
+		{
+			// 后出现的search/domain覆盖之前的
+			m_search.clear();
+			while(ss >> value)
+			{
+				m_search.push_back(to_lower(value));
+			}
+		}
+		else if(key == "options")
+		{
+			while(ss >> value)
+			{
+				if(value.compare(0, 6, "ndots:") == 0)
+				{
+					m_ndots = atoi(value.c_str() + 6);
+				}
+				else if(m_manualOptions)
+				{
+					continue;
+				}
+				else if(value.compare(0, 8, "timeout:") == 0)
+				{
+					m_timeout = atoi(value.c_str() + 8) * 1000;
+				}
+				else if(value.compare(0, 9, "attempts:") == 0)
+				{
+					m_attempts = std::max(atoi(value.c_str() + 9), 1);
+				}
+			}
+		}
+	}
+
+	// 与glibc一致，没有配置时使用本机
+	if(servers.empty())
+	{
+		servers.push_back("127.0.0.1");
+	}
+
+	if(!m_manualServers)
+	{
+		m_servers = ParseServers(servers, 53);
+	}
+	if(debug) std::cout << "DnsResolver::loadConfig() " << m_servers.size() << " servers" << std::endl;
+}
+
+bool DnsResolver::lookupHosts(const std::string& name, int family, std::vector<Address>& addrs)
+{
+	std::lock_guard<std::mutex> lock(m_hostsMutex);
+
+	time_t mtime = file_mtime(HOSTS_FILE);
+	if(mtime != m_hostsMtime)
+	{
+		m_hostsMtime = mtime;
+		m_hosts.clear();
+
+		// 普通文件的读取不会在epoll上等待，直接读取即可
+		std::ifstream in(HOSTS_FILE);
+		std::string line;
+		while(std::getline(in, line))
+		{
+			line = line.substr(0, line.find('#'));
+			std::istringstream ss(line);
+			std::string ip, host;
+			Address addr;
+			if(!(ss >> ip) || !parse_address(ip, addr))
+			{
+				continue;
+			}
+			while(ss >> host)
+			{
+				m_hosts[to_lower(host)].push_back(addr);
+			}
+		}
+	}
+
+	auto it = m_hosts.find(name);
+	if(it == m_hosts.end())
+	{
+		return false;
+	}
+
+	for(auto& i : it->second)
+	{
+		if(family == AF_UNSPEC || family == i.family)
+		{
+			addrs.push_back(i);
+		}
+	}
+	return !addrs.empty();
+}
+
+bool DnsResolver::getCache(const std::string& key, Result& result, std::vector<Address>& addrs)
+{
+	std::shared_lock<std::shared_mutex> read_lock(m_cacheMutex);
+	auto it = m_cache.find(key);
+	if(it == m_cache.end() || it->second.expire <= std::chrono::steady_clock::now())
+	{
+		return false;
+	}
+	result = it->second.result;
+	addrs = it->second.addrs;
+	return true;
+}
+
+void DnsResolver::putCache(const std::string& key, Result result, const std::vector<Address>& addrs, uint32_t ttl)
+{
+	if(ttl == 0)
+	{
+		return;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	std::unique_lock<std::shared_mutex> write_lock(m_cacheMutex);
+	if(m_cache.size() >= MAX_CACHE_SIZE)
+	{
+		// 先清理过期的条目，仍然满了则整体清空
+		for(auto it = m_cache.begin(); it != m_cache.end();)
+		{
+			it = it->second.expire <= now ? m_cache.erase(it) : ++it;
+		}
+		if(m_cache.size() >= MAX_CACHE_SIZE)
+		{
+			m_cache.clear();
+		}
+	}
+
+	CacheEntry& entry = m_cache[key];
+	entry.result = result;
+	entry.addrs  = addrs;
+	entry.expire = now + std::chrono::seconds(ttl);
+}
+
+// 跳过报文中的一个域名（可能是压缩指针）
+static bool skip_name(const unsigned char* msg, size_t len, size_t& pos)
+{
+	while(pos < len)
+	{
+		unsigned char c = msg[pos];
+		if(c == 0)
+		{
+			pos++;
+			return true;
+		}
+		if((c & 0xC0) == 0xC0)
+		{
+			pos += 2;
+			return pos <= len;
+		}
+		pos += c + 1;
+	}
+	return false;
+}
+
+static uint16_t read16(const unsigned char* p)
+{
+	return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t read32(const unsigned char* p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+// 构造查询报文，域名非法时返回false
+static bool build_query(uint16_t id, const std::string& name, uint16_t qtype, std::string& packet)
+{
+	packet.clear();
+	unsigned char header[DNS_HEADER_SIZE] = {0};
+	header[0] = id >> 8;
+	header[1] = id & 0xff;
+	header[2] = 0x01;  // RD
+	header[5] = 1;     // QDCOUNT
+	packet.append((const char*)header, sizeof(header));
+
+	size_t start = 0;
+	while(start < name.size())
+	{
+		size_t end = name.find('.', start);
+		if(end == std::string::npos)
+		{
+			end = name.size();
+		}
+		size_t label = end - start;
+		if(label == 0 || label > 63)
+		{
+			return false;
+		}
+		packet.push_back((char)label);
+		packet.append(name, start, label);
+		start = end + 1;
+	}
+	packet.push_back('\0');
+
+	unsigned char tail[4] = {(unsigned char)(qtype >> 8), (unsigned char)(qtype & 0xff), 0, DNS_CLASS_IN};
+	packet.append((const char*)tail, sizeof(tail));
+	return packet.size() <= DNS_MAX_UDP;
+}
+
+// 解析应答报文，ttl返回所有应答记录中最小的TTL（否定应答为SOA的minimum）
+static DnsResolver::Result parse_response(const unsigned char* msg, size_t len, uint16_t qtype,
+	std::vector<DnsResolver::Address>& addrs, uint32_t& ttl)
+{
+	uint16_t flags   = read16(msg + 2);
+	uint16_t qdcount = read16(msg + 4);
+	uint16_t ancount = read16(msg + 6);
+	uint16_t nscount = read16(msg + 8);
+	int rcode = flags & 0x0f;
+
+	if(rcode == 2 || rcode == 5)  // SERVFAIL REFUSED
+	{
+		return DnsResolver::RETRY;
+	}
+	if(rcode != 0 && rcode != 3)
+	{
+		return DnsResolver::FAIL;
+	}
+
+	size_t pos = DNS_HEADER_SIZE;
+	for(int i = 0; i < qdcount; i++)
+	{
+		if(!skip_name(msg, len, pos))
+		{
+			return DnsResolver::FAIL;
+		}
+		pos += 4;
+	}
+
+	ttl = (uint32_t)-1;
+	for(int i = 0; i < ancount + nscount; i++)
+	{
+		if(!skip_name(msg, len, pos) || pos + 10 > len)
+		{
+			return DnsResolver::FAIL;
+		}
+		uint16_t type   = read16(msg + pos);
+		uint16_t klass  = read16(msg + pos + 2);
+		uint32_t rr_ttl = read32(msg + pos + 4);
+		uint16_t rdlen  = read16(msg + pos + 8);
+		pos += 10;
+		if(pos + rdlen > len)
+		{
+			return DnsResolver::FAIL;
+		}
+
+		if(i < ancount)
+		{
+			// 应答中的CNAME链由服务器展开，只需收集目标类型的记录
+			size_t size = qtype == DNS_TYPE_A ? 4 : 16;
+			if(type == qtype && klass == DNS_CLASS_IN && rdlen == size)
+			{
+				DnsResolver::Address addr;
+				addr.family = qtype == DNS_TYPE_A ? AF_INET : AF_INET6;
+				memcpy(addr.addr, msg + pos, size);
+				addrs.push_back(addr);
+				ttl = std::min(ttl, rr_ttl);
+			}
+		}
+		else if(type == DNS_TYPE_SOA && addrs.empty())
+		{
+			// 否定应答的缓存时间 RFC 2308
+			size_t rpos = pos;
+			if(skip_name(msg, len, rpos) && skip_name(msg, len, rpos) && rpos + 20 <= pos + rdlen)
+			{
+				ttl = std::min(rr_ttl, read32(msg + rpos + 16));
+			}
+		}
+		pos += rdlen;
+	}
+
+	if(ttl == (uint32_t)-1)
+	{
+		ttl = 0;
+	}
+	if(rcode == 3)
+	{
+		return DnsResolver::NXDOMAIN;
+	}
+	return addrs.empty() ? DnsResolver::NODATA : DnsResolver::OK;
+}
+
+DnsResolver::Result DnsResolver::queryServer(const Server& server, const std::string& name, uint16_t qtype,
+	std::vector<Address>& addrs, uint32_t& ttl)
+{
+	static thread_local std::mt19937 s_rand(std::random_device{}());
+	uint16_t id = s_rand() & 0xffff;
+
+	std::string packet;
+	if(!build_query(id, name, qtype, packet))
+	{
+		return FAIL;
+	}
+
+	// hook后的socket：等待应答时挂起当前协程，超时由SO_RCVTIMEO控制
+	int fd = socket(server.addr.ss_family, SOCK_DGRAM, 0);
+	if(fd == -1)
+	{
+		return RETRY;
+	}
+
+	uint64_t timeout;
+	{
+		std::lock_guard<std::mutex> lock(m_confMutex);
+		timeout = m_timeout;
+	}
+	timeval tv;
+	tv.tv_sec  = timeout / 1000;
+	tv.tv_usec = timeout % 1000 * 1000;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	Result result = RETRY;
+	if(sendto(fd, packet.data(), packet.size(), 0, (const sockaddr*)&server.addr, server.len) == (ssize_t)packet.size())
+	{
+		unsigned char buf[DNS_MAX_UDP];
+		while(true)
+		{
+			sockaddr_storage from;
+			socklen_t from_len = sizeof(from);
+			ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, (sockaddr*)&from, &from_len);
+			if(n < 0)
+			{
+				if(debug) std::cout << "DnsResolver::queryServer() recvfrom failed: " << strerror(errno) << std::endl;
+				break;
+			}
+
+			// 丢弃来源不符、id不匹配或者不是应答的报文
+			if(from_len != server.len || memcmp(&from, &server.addr, from_len) != 0
+				|| (size_t)n < DNS_HEADER_SIZE || read16(buf) != id || !(buf[2] & 0x80))
+			{
+				continue;
+			}
+
+			// 被截断的应答中仍可能带有完整的地址记录，没有记录时当作失败，换下一个服务器
+			result = parse_response(buf, n, qtype, addrs, ttl);
+			if((buf[2] & 0x02) && result == NODATA)
+			{
+				result = RETRY;
+			}
+			break;
+		}
+	}
+
+	close(fd);
+	return result;
+}
+
+DnsResolver::Result DnsResolver::query(const std::string& name, uint16_t qtype, std::vector<Address>& addrs)
+{
+	std::string key = name + (qtype == DNS_TYPE_A ? "|A" : "|AAAA");
+	Result result;
+	if(getCache(key, result, addrs))
+	{
+		return result;
+	}
+
+	std::vector<Server> servers;
+	int attempts;
+	{
+		std::lock_guard<std::mutex> lock(m_confMutex);
+		loadConfig();
+		servers  = m_servers;
+		attempts = m_attempts;
+	}
+
+	result = RETRY;
+	for(int i = 0; i < attempts && result == RETRY; i++)
+	{
+		for(auto& server : servers)
+		{
+			uint32_t ttl = 0;
+			std::vector<Address> found;
+			result = queryServer(server, name, qtype, found, ttl);
+			if(result != RETRY)
+			{
+				if(result != FAIL)
+				{
+					putCache(key, result, found, ttl);
+				}
+				addrs.insert(addrs.end(), found.begin(), found.end());
+				break;
+			}
+		}
+	}
+	return result;
+}
+
+DnsResolver::Result DnsResolver::lookup(const std::string& name, uint16_t qtype, std::vector<Address>& addrs)
+{
+	// 绝对域名
+	if(name.back() == '.')
+	{
+		return query(name.substr(0, name.size() - 1), qtype, addrs);
+	}
+
+	std::vector<std::string> search;
+	int ndots;
+	{
+		std::lock_guard<std::mutex> lock(m_confMutex);
+		loadConfig();
+		search = m_search;
+		ndots  = m_ndots;
+	}
+
+	// 点数不少于ndots时先按绝对域名查询，否则先尝试search列表
+	std::vector<std::string> candidates;
+	bool as_is_first = std::count(name.begin(), name.end(), '.') >= ndots;
+	if(as_is_first)
+	{
+		candidates.push_back(name);
+	}
+	for(auto& i : search)
+	{
+		candidates.push_back(name + "." + i);
+	}
+	if(!as_is_first)
+	{
+		candidates.push_back(name);
+	}
+
+	Result result = NXDOMAIN;
+	for(auto& i : candidates)
+	{
+		Result rt = query(i, qtype, addrs);
+		if(rt == OK)
+		{
+			return OK;
+		}
+		// 记录最有意义的错误：RETRY > NODATA > NXDOMAIN
+		if(rt == RETRY || rt == FAIL || (rt == NODATA && result == NXDOMAIN))
+		{
+			result = rt;
+		}
+	}
+	return result;
+}
+
+DnsResolver::Result DnsResolver::resolve(const std::string& host, int family, std::vector<Address>& addrs)
+{
+	if(host.empty() || host.size() > 254)
+	{
+		return FAIL;
+	}
+	std::string name = to_lower(host);
+
+	if(lookupHosts(name.back() == '.' ? name.substr(0, name.size() - 1) : name, family, addrs))
+	{
+		return OK;
+	}
+
+	if(family == AF_INET)
+	{
+		return lookup(name, DNS_TYPE_A, addrs);
+	}
+	if(family == AF_INET6)
+	{
+		return lookup(name, DNS_TYPE_AAAA, addrs);
+	}
+
+	// AF_UNSPEC: 任一类型有结果即成功
+	Result v4 = lookup(name, DNS_TYPE_A, addrs);
+	if(v4 == NXDOMAIN)
+	{
+		return v4;
+	}
+	Result v6 = lookup(name, DNS_TYPE_AAAA, addrs);
+	if(v4 == OK || v6 == OK)
+	{
+		return OK;
+	}
+	return v4 == RETRY ? v4 : v6;
+}
+
+}
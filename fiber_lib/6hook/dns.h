@@ -0,0 +1,116 @@
+#ifndef _DNS_H_
+#define _DNS_H_
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
+#include <chrono>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+namespace sylar {
+
+// 协程化的DNS解析器：通过hook后的UDP socket向/etc/resolv.conf中的服务器发送查询，等待应答时只挂起当前协程
+// 解析顺序与glibc默认的"files dns"一致：先查/etc/hosts，再查询DNS服务器，应答按TTL缓存在进程内
+class DnsResolver
+{
+public:
+	// 解析结果
+	enum Result
+	{
+		OK = 0,
+		// 域名不存在（NXDOMAIN）
+		NXDOMAIN,
+		// 域名存在但没有对应类型的记录
+		NODATA,
+		// 超时或服务器暂时失败
+		RETRY,
+		// 不可恢复的错误（非法域名、应答格式错误等）
+		FAIL
+	};
+
+	struct Address
+	{
+		// AF_INET or AF_INET6
+		int family = AF_INET;
+		// in_addr or in6_addr, network byte order
+		unsigned char addr[16] = {0};
+	};
+
+	DnsResolver();
+
+	// family: AF_INET, AF_INET6 or AF_UNSPEC(查询A和AAAA)
+	Result resolve(const std::string& name, int family, std::vector<Address>& addrs);
+
+	// 覆盖resolv.conf中的服务器（数字地址），用于测试时指向本地的stub服务器
+	void setServers(const std::vector<std::string>& servers, uint16_t port = 53);
+	// 单次查询的超时时间
+	void setTimeout(uint64_t ms);
+	// 每个服务器的尝试次数
+	void setAttempts(int attempts);
+
+	void clearCache();
+
+public:
+	static DnsResolver* GetInstance();
+
+private:
+	struct Server
+	{
+		sockaddr_storage addr;
+		socklen_t len = 0;
+	};
+
+	struct CacheEntry
+	{
+		Result result = OK;
+		std::vector<Address> addrs;
+		std::chrono::time_point<std::chrono::steady_clock> expire;
+	};
+
+	static std::vector<Server> ParseServers(const std::vector<std::string>& servers, uint16_t port);
+
+	// 按需（重新）加载resolv.conf，文件修改后自动生效
+	void loadConfig();
+	// 查询/etc/hosts
+	bool lookupHosts(const std::string& name, int family, std::vector<Address>& addrs);
+	// 对完整域名依次尝试所有服务器
+	Result query(const std::string& name, uint16_t qtype, std::vector<Address>& addrs);
+	// 向一个服务器发送一次查询
+	Result queryServer(const Server& server, const std::string& name, uint16_t qtype, std::vector<Address>& addrs, uint32_t& ttl);
+	// 带缓存的查询，并按search列表展开短域名
+	Result lookup(const std::string& name, uint16_t qtype, std::vector<Address>& addrs);
+
+	bool getCache(const std::string& key, Result& result, std::vector<Address>& addrs);
+	void putCache(const std::string& key, Result result, const std::vector<Address>& addrs, uint32_t ttl);
+
+private:
+	// 保护配置
+	std::mutex m_confMutex;
+	std::vector<Server> m_servers;
+	std::vector<std::string> m_search;
+	int m_ndots = 1;
+	uint64_t m_timeout = 5000;
+	int m_attempts = 2;
+	// resolv.conf的修改时间，0表示尚未加载
+	time_t m_confMtime = 0;
+	// 是否通过setServers()手动指定了服务器
+	bool m_manualServers = false;
+	// 是否通过setTimeout()/setAttempts()手动指定了选项
+	bool m_manualOptions = false;
+
+	// hosts文件: 域名 -> 地址
+	std::mutex m_hostsMutex;
+	std::unordered_map<std::string, std::vector<Address>> m_hosts;
+	time_t m_hostsMtime = 0;
+
+	// 应答缓存: 域名|类型 -> 结果
+	std::shared_mutex m_cacheMutex;
+	std::unordered_map<std::string, CacheEntry> m_cache;
+};
+
+}
+
+#endif
@@ -1,9 +1,11 @@
 #include "fd_manager.h"
 #include "hook.h"
 
+#include <algorithm>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <sys/epoll.h>
 
 namespace sylar{
 
@@ -17,15 +19,27 @@ T* Singleton<T>::instance = nullptr;
 template<typename T>
 std::mutex Singleton<T>::mutex;	   //模板类的静态成员变量需要在类外进行显式定义和初始化
 
-FdCtx::FdCtx(int fd):
+FdCtx::FdCtx(int fd, Type type):
 m_fd(fd)
 {
-	init();
+	if(type == UNKNOWN)
+	{
+		init();
+		return;
+	}
+
+	m_isInit      = true;
+	m_isSocket    = type == SOCKET;
+	m_isPollable  = true;
+	m_sysNonblock = true;
 }
 
 FdCtx::~FdCtx()
 {
-
+	if(m_zerocopyEpfd != -1)
+	{
+		close_f(m_zerocopyEpfd);
+	}
 }
 
 bool FdCtx::init()
@@ -46,10 +60,11 @@ bool FdCtx::init()
 	{
 		m_isInit = true;	
 		m_isSocket = S_ISSOCK(statbuf.st_mode);	   // 使用S_ISSOCK宏检查文件描述符是否为socket
+		m_isPollable = m_isSocket || S_ISFIFO(statbuf.st_mode);
 	}
 
-	// if it is a socket -> set to nonblock
-	if(m_isSocket)
+	// if it is pollable -> set to nonblock
+	if(m_isPollable)
 	{
 		// fcntl_f() -> the original fcntl() -> get the socket info
 		int flags = fcntl_f(m_fd, F_GETFL, 0);  // 使用fcntl_f函数获取当前文件描述符的标志
@@ -92,6 +107,89 @@ uint64_t FdCtx::getTimeout(int type)
 	}
 }
 
+bool FdCtx::setZeroCopy(bool v)
+{
+	std::lock_guard<std::mutex> lock(m_zerocopyMutex);
+	if(v == (m_zerocopyEpfd != -1))
+	{
+		return true;
+	}
+
+	if(!v)
+	{
+		close_f(m_zerocopyEpfd);
+		m_zerocopyEpfd = -1;
+		return true;
+	}
+
+	// 注册的事件为0 -> 只在EPOLLERR（错误队列非空）或EPOLLHUP时就绪，与IOManager中的读写事件互不影响
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(epfd == -1)
+	{
+		return false;
+	}
+	epoll_event event;
+	event.events  = 0;
+	event.data.fd = m_fd;
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, m_fd, &event))
+	{
+		close_f(epfd);
+		return false;
+	}
+	m_zerocopyEpfd = epfd;
+	return true;
+}
+
+uint32_t FdCtx::nextZeroCopyId(uint32_t count)
+{
+	std::lock_guard<std::mutex> lock(m_zerocopyMutex);
+	uint32_t id = m_zerocopyNext;
+	m_zerocopyNext += count;
+	return id;
+}
+
+void FdCtx::completeZeroCopy(uint32_t lo, uint32_t hi)
+{
+	std::lock_guard<std::mutex> lock(m_zerocopyMutex);
+	// 通知通常按序到达，[lo, hi]紧接着已完成的范围；不连续时（如UDP）先记下，等前面的完成后再合并
+	if((int32_t)(lo - m_zerocopyCompleted) > 0)
+	{
+		m_zerocopyPending.emplace_back(lo, hi);
+		return;
+	}
+	if((int32_t)(hi + 1 - m_zerocopyCompleted) > 0)
+	{
+		m_zerocopyCompleted = hi + 1;
+	}
+
+	bool merged = true;
+	while(merged && !m_zerocopyPending.empty())
+	{
+		merged = false;
+		for(size_t i = 0; i < m_zerocopyPending.size(); i++)
+		{
+			auto range = m_zerocopyPending[i];
+			if((int32_t)(range.first - m_zerocopyCompleted) > 0)
+			{
+				continue;
+			}
+			if((int32_t)(range.second + 1 - m_zerocopyCompleted) > 0)
+			{
+				m_zerocopyCompleted = range.second + 1;
+			}
+			m_zerocopyPending.erase(m_zerocopyPending.begin() + i);
+			merged = true;
+			break;
+		}
+	}
+}
+
+bool FdCtx::isZeroCopyDone(uint32_t id)
+{
+	std::lock_guard<std::mutex> lock(m_zerocopyMutex);
+	return (int32_t)(m_zerocopyCompleted - id) > 0;
+}
+
 FdManager::FdManager()
 {
 	m_datas.resize(64);
@@ -134,6 +232,53 @@ std::shared_ptr<FdCtx> FdManager::get(int fd, bool auto_create) // auto_create
 
 }
 
+std::shared_ptr<FdCtx> FdManager::add(int fd, FdCtx::Type type)
+{
+	if(fd < 0)
+	{
+		return nullptr;
+	}
+
+	std::shared_ptr<FdCtx> ctx = std::make_shared<FdCtx>(fd, type);
+	set(fd, ctx);
+	return ctx;
+}
+
+std::shared_ptr<FdCtx> FdManager::dup(int oldfd, int newfd)
+{
+	std::shared_ptr<FdCtx> old = get(oldfd);
+	// 源fd不受管理 -> 新fd同样不受管理
+	if(!old || old->isClosed())
+	{
+		del(newfd);
+		return nullptr;
+	}
+
+	// 复制出的fd与源fd共享同一个打开文件，非阻塞标志和socket选项都是共享的
+	std::shared_ptr<FdCtx> ctx = std::make_shared<FdCtx>(newfd, old->getType());
+	ctx->setUserNonblock(old->getUserNonblock());
+	ctx->setTimeout(SO_RCVTIMEO, old->getTimeout(SO_RCVTIMEO));
+	ctx->setTimeout(SO_SNDTIMEO, old->getTimeout(SO_SNDTIMEO));
+	set(newfd, ctx);
+	return ctx;
+}
+
+void FdManager::set(int fd, std::shared_ptr<FdCtx> ctx)
+{
+	if(fd < 0)
+	{
+		return;
+	}
+
+	std::unique_lock<std::shared_mutex> write_lock(m_mutex);
+	if(m_datas.size() <= (size_t)fd)
+	{
+		// fd为0或1时fd*1.5不足以容纳fd
+		m_datas.resize(std::max((size_t)fd + 1, (size_t)(fd*1.5)));
+	}
+	m_datas[fd] = ctx;
+}
+
 void FdManager::del(int fd)
 {
 	std::unique_lock<std::shared_mutex> write_lock(m_mutex);
@@ -12,11 +12,24 @@ namespace sylar{
 // fd info
 class FdCtx : public std::enable_shared_from_this<FdCtx>
 {
+public:
+	// fd类型，由hook在创建fd时直接给出
+	enum Type
+	{
+		// 未知 -> init()中通过fstat判断并设置非阻塞
+		UNKNOWN = 0,
+		SOCKET,
+		// 可以被epoll监听的非socket fd：管道、eventfd
+		PIPE
+	};
+
 private:
 	// 是否初始化
 	bool m_isInit = false;
 	// 是否是socket
 	bool m_isSocket = false;
+	// 是否可以被epoll监听 -> hook后的读写会挂起协程而不是阻塞线程
+	bool m_isPollable = false;
 	//是否被系统设置为非阻塞（系统调用）
 	bool m_sysNonblock = false;
 	//是否被用户设置为非阻塞（用户调用）
@@ -31,13 +44,27 @@ private:
 	// write event timeout
 	uint64_t m_sendTimeout = (uint64_t)-1;
 
+	// MSG_ZEROCOPY 完成通知
+	std::mutex m_zerocopyMutex;
+	// 只监听该socket错误队列的epoll实例，setZeroCopy(true)时创建
+	int m_zerocopyEpfd = -1;
+	// 下一次zerocopy发送的序号（内核对每次成功的zerocopy发送从0开始计数）
+	uint32_t m_zerocopyNext = 0;
+	// 序号小于该值的发送都已完成
+	uint32_t m_zerocopyCompleted = 0;
+	// 先于更早的发送到达的完成通知[lo, hi]，等前面的完成后合并
+	std::vector<std::pair<uint32_t, uint32_t>> m_zerocopyPending;
+
 public:
-	FdCtx(int fd);
+	// type不为UNKNOWN时，调用者保证fd创建时已经是非阻塞的（SOCK_NONBLOCK/O_NONBLOCK），省去fstat和fcntl
+	FdCtx(int fd, Type type = UNKNOWN);
 	~FdCtx();
 
 	bool init();
 	bool isInit() const {return m_isInit;}
 	bool isSocket() const {return m_isSocket;}
+	bool isPollable() const {return m_isPollable;}
+	Type getType() const {return m_isSocket ? SOCKET : (m_isPollable ? PIPE : UNKNOWN);}
 	bool isClosed() const {return m_isClosed;}
 
 	void setUserNonblock(bool v) {m_userNonblock = v;}
@@ -48,6 +75,16 @@ public:
 
 	void setTimeout(int type, uint64_t v);  //设置超时时间，type=SO_RCVTIMEO表示读超时，type=SO_SNDTIMEO表示写超时
 	uint64_t getTimeout(int type);
+
+	// 用户通过setsockopt(SO_ZEROCOPY)开启后，带MSG_ZEROCOPY的send会等待缓冲区可以重用再返回
+	bool setZeroCopy(bool v);
+	bool isZeroCopy() const {return m_zerocopyEpfd != -1;}
+	int getZeroCopyEpfd() const {return m_zerocopyEpfd;}
+	// 为连续count次zerocopy发送分配序号，返回第一个
+	uint32_t nextZeroCopyId(uint32_t count = 1);
+	// 错误队列中读到[lo, hi]范围的完成通知
+	void completeZeroCopy(uint32_t lo, uint32_t hi);
+	bool isZeroCopyDone(uint32_t id);
 };
 
 class FdManager
@@ -56,8 +93,13 @@ public:
 	FdManager();
 
 	std::shared_ptr<FdCtx> get(int fd, bool auto_create = false); // 获取或创建 FD 上下文
+	std::shared_ptr<FdCtx> add(int fd, FdCtx::Type type);  // 为新创建的已知类型fd创建上下文，覆盖旧的上下文
+	std::shared_ptr<FdCtx> dup(int oldfd, int newfd);      // newfd由oldfd复制而来 -> 继承类型、非阻塞状态和超时时间
 	void del(int fd);    // 删除 FD 上下文（close 时调用）
 
+private:
+	void set(int fd, std::shared_ptr<FdCtx> ctx);
+
 private:
 	std::shared_mutex m_mutex;
 	std::vector<std::shared_ptr<FdCtx>> m_datas;
@@ -1,4 +1,10 @@
 #include "fiber.h"
+#include "scheduler.h"
+#include "hook.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <time.h>
 
 static bool debug = false;
 
@@ -9,14 +15,71 @@ namespace sylar {
 // 正在运行的协程，每个线程有自己独立的实例
 static thread_local Fiber* t_fiber = nullptr;
 // 主协程
-static thread_local std::shared_ptr<Fiber> t_thread_fiber = nullptr;
+static thread_local RefPtr<Fiber> t_thread_fiber = nullptr;
 // 调度协程
 static thread_local Fiber* t_scheduler_fiber = nullptr;
 
+// switchTo()切换到的协程：持有其运行权直到控制权回到调度协程，期间其他线程不能resume它
+static thread_local std::vector<RefPtr<Fiber>> t_switched;
+// 本次被调度协程resume的协程，其运行权由Scheduler::run持有
+static thread_local Fiber* t_root = nullptr;
+// 回到调度协程前已经连续switchTo()的次数
+static thread_local uint32_t t_switch_count = 0;
+// 连续直接切换的上限，超过后回到调度协程，让任务队列中的其他协程和idle（epoll、定时器）有机会运行
+static const uint32_t MAX_SWITCH_CHAIN = 64;
+// SetNext()记录的协程（已在任务队列中）：当前协程下一次yield()时从队列中取回并直接切换过去
+static thread_local RefPtr<Fiber> t_next = nullptr;
+// 正在切换出去的协程，由切换后的上下文调用FinishSwitch()处理
+static thread_local Fiber* t_prev = nullptr;
+
 // 协程id， 全局共享
 static std::atomic<uint64_t> s_fiber_id{0};
 // 协程计数器， 全局共享
 static std::atomic<uint64_t> s_fiber_count{0};
+// 已分配的协程局部存储槽位数， 全局共享
+static std::atomic<size_t> s_local_count{0};
+// 协作式预算， 全局共享
+static std::atomic<uint32_t> s_yield_budget{128};
+
+StackPool::StackPool(size_t stacksize, size_t max_cached):
+m_stacksize(stacksize), m_maxCached(max_cached)
+{
+}
+
+StackPool::~StackPool()
+{
+	for(void* stack : m_free)
+	{
+		free(stack);
+	}
+}
+
+void* StackPool::acquire()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(!m_free.empty())
+		{
+			void* stack = m_free.back();
+			m_free.pop_back();
+			return stack;
+		}
+	}
+	return malloc(m_stacksize);
+}
+
+void StackPool::release(void* stack)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(m_free.size() < m_maxCached)
+		{
+			m_free.push_back(stack);
+			return;
+		}
+	}
+	free(stack);
+}
 
 void Fiber::SetThis(Fiber *f)
 {
@@ -24,21 +87,26 @@ void Fiber::SetThis(Fiber *f)
 }
 
 // 首先运行该函数创建主协程
-std::shared_ptr<Fiber> Fiber::GetThis()
+RefPtr<Fiber> Fiber::GetThis()
+{
+	return RefPtr<Fiber>(Current());
+}
+
+Fiber* Fiber::Current()
 {
 	if(t_fiber)
 	{	
-		return t_fiber->shared_from_this();
+		return t_fiber;
 	}
 
-	std::shared_ptr<Fiber> main_fiber(new Fiber());
+	RefPtr<Fiber> main_fiber(new Fiber());
 	t_thread_fiber = main_fiber;
 	t_scheduler_fiber = main_fiber.get(); // 除非主动设置 主协程默认为调度协程
 	
 	// t_fiber = main_fiber.get();      // 当前协程t_fiber为主协程
 
 	assert(t_fiber == main_fiber.get());
-	return t_fiber->shared_from_this();
+	return t_fiber;
 }
 
 void Fiber::SetSchedulerFiber(Fiber* f)
@@ -55,6 +123,70 @@ uint64_t Fiber::GetFiberId()
 	return (uint64_t)-1;
 }
 
+size_t Fiber::RegisterLocal()
+{
+	return s_local_count++;
+}
+
+void* Fiber::GetLocal(size_t index)
+{
+	return Current()->getLocal(index);
+}
+
+void Fiber::SetLocal(size_t index, void* value, void (*destroy)(void*))
+{
+	Current()->setLocal(index, value, destroy);
+}
+
+void Fiber::setLocal(size_t index, void* value, void (*destroy)(void*))
+{
+	if(index >= m_locals.size())
+	{
+		// 一次扩展到所有已注册的槽位，避免逐个增长
+		m_locals.resize(std::max(index + 1, s_local_count.load()));
+	}
+	LocalSlot& slot = m_locals[index];
+	if(slot.value && slot.destroy)
+	{
+		slot.destroy(slot.value);
+	}
+	slot.value = value;
+	slot.destroy = destroy;
+}
+
+void Fiber::clearLocals()
+{
+	// 析构函数中可能再次设置其他槽位 -> 直到所有槽位为空
+	bool again = true;
+	while(again)
+	{
+		again = false;
+		for(size_t i = 0; i < m_locals.size(); i++)
+		{
+			LocalSlot slot = m_locals[i];
+			if(!slot.value)
+			{
+				continue;
+			}
+			m_locals[i] = LocalSlot();
+			if(slot.destroy)
+			{
+				slot.destroy(slot.value);
+			}
+			again = true;
+		}
+	}
+}
+
+CancelToken* Fiber::GetCancelToken()
+{
+	if(t_fiber)
+	{
+		return t_fiber->m_cancelToken;
+	}
+	return nullptr;
+}
+
 //两个构造函数关于创建栈的解释：
 //主协程是线程启动时默认存在的协程，通常运行在主线程的栈上，而不是在单独分配的栈空间中运行。
 //主协程的上下文直接使用线程的栈，因此不需要额外分配栈空间。
@@ -64,6 +196,11 @@ Fiber::Fiber()   // 用于创建一个主协程
 {
 	SetThis(this);
 	m_state = RUNNING;
+	// 主协程从创建起就在运行
+	m_runSeq.store(1, std::memory_order_relaxed);
+#ifdef SYLAR_FIBER_STATS
+	m_runStart = Ticks();
+#endif
 	
 	if(getcontext(&m_ctx))
 	{
@@ -73,21 +210,30 @@ Fiber::Fiber()   // 用于创建一个主协程
 	
 	m_id = s_fiber_id++;
 	s_fiber_count ++;
+	Register(this);
 	if(debug) std::cout << "Fiber(): main id = " << m_id << std::endl;
 }
 
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler):
-m_cb(cb), m_runInScheduler(run_in_scheduler)   // 用于创建子协程
+Fiber::Fiber(Callback cb, size_t stacksize, bool run_in_scheduler, StackPool* pool):
+m_pool(pool), m_cb(std::move(cb)), m_runInScheduler(run_in_scheduler)   // 用于创建子协程
 {
 	m_state = READY;
 
-	// 分配协程栈空间  自定义大小或250kb
-	m_stacksize = stacksize ? stacksize : 128000;
-	m_stack = malloc(m_stacksize);
+	// 分配协程栈空间  缓存池、自定义大小或250kb
+	if(m_pool)
+	{
+		m_stacksize = m_pool->getStackSize();
+		m_stack = m_pool->acquire();
+	}
+	else
+	{
+		m_stacksize = stacksize ? stacksize : 128000;
+		m_stack = malloc(m_stacksize);
+	}
 
 	if(getcontext(&m_ctx))
 	{
-		std::cerr << "Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler) failed\n";
+		std::cerr << "Fiber(Callback cb, size_t stacksize, bool run_in_scheduler, StackPool* pool) failed\n";
 		pthread_exit(NULL);
 	}
 	
@@ -98,27 +244,49 @@ m_cb(cb), m_runInScheduler(run_in_scheduler)   // 用于创建子协程
 	
 	m_id = s_fiber_id++;
 	s_fiber_count ++;
+	m_entry.store(&m_cb.target_type(), std::memory_order_relaxed);
+	Register(this);
 	if(debug) std::cout << "Fiber(): child id = " << m_id << std::endl;
 }
 
 Fiber::~Fiber()
 {
+	// 先移出注册表：Snapshot()持有注册表的锁时协程不会被销毁
+	Unregister(this);
+	clearLocals();
 	s_fiber_count --;
 	if(m_stack)
 	{
-		free(m_stack);
+		if(m_pool)
+		{
+			m_pool->release(m_stack);
+		}
+		else
+		{
+			free(m_stack);
+		}
 	}
 	if(debug) std::cout << "~Fiber(): id = " << m_id << std::endl;	
 }
 
 //reset函数的主要功能是重置一个已经终止的协程（m_state == TERM），使其重新进入就绪状态（READY），
 //并为其分配一个新的任务（cb）。这样，协程可以被重新使用，而不需要销毁并重新创建。
-void Fiber::reset(std::function<void()> cb)
+void Fiber::reset(Callback cb)
 {
 	assert(m_stack != nullptr&&m_state == TERM);
 
+	clearLocals();
 	m_state = READY;
-	m_cb = cb;
+	m_cb = std::move(cb);
+	m_entry.store(&m_cb.target_type(), std::memory_order_relaxed);
+	setWaitState(WAIT_NONE);
+#ifdef SYLAR_FIBER_STATS
+	m_cpuTicks.store(0, std::memory_order_relaxed);
+	m_switches.store(0, std::memory_order_relaxed);
+	m_delayTicks.store(0, std::memory_order_relaxed);
+	m_maxDelayTicks.store(0, std::memory_order_relaxed);
+	m_taskName = nullptr;
+#endif
 
 	if(getcontext(&m_ctx))
 	{
@@ -135,71 +303,346 @@ void Fiber::reset(std::function<void()> cb)
 void Fiber::resume()  //恢复一个协程的执行
 {
 	assert(m_state==READY);
+	Current();
 	
 	m_state = RUNNING;
+	m_budget = s_yield_budget.load(std::memory_order_relaxed);
+
+	// 调度协程、主协程或任意正在运行的协程都可以resume -> 记录下来，yield()时回到它
+	m_resumer = t_fiber;
 
-	if(m_runInScheduler)
+	// 嵌套：被任务协程resume的子协程不受Scheduler::run的运行权保护，不能在挂起期间被其他线程唤醒
+	// -> 子协程运行期间关闭hook，阻塞调用直接阻塞线程，同步原语退化为信号量
+	bool nested = m_resumer != t_scheduler_fiber && m_resumer != t_thread_fiber.get();
+	bool hook = is_hook_enable();
+	if(nested)
 	{
-		SetThis(this);
-		if(swapcontext(&(t_scheduler_fiber->m_ctx), &m_ctx))  //swapcontext 不会返回，而是直接切换到新的上下文并开始执行。
-		{
-			std::cerr << "resume() to t_scheduler_fiber failed\n";
-			pthread_exit(NULL);
-		}		
+		set_hook_enable(false);
 	}
-	else
+
+	setWaitState(WAIT_NONE);
+	SetThis(this);
+	if(Swap(m_resumer, this))  //swapcontext 不会返回，而是直接切换到新的上下文并开始执行。
 	{
-		SetThis(this);
-		if(swapcontext(&(t_thread_fiber->m_ctx), &m_ctx))
-		{
-			std::cerr << "resume() to t_thread_fiber failed\n";
-			pthread_exit(NULL);
-		}	
+		std::cerr << "resume() failed\n";
+		pthread_exit(NULL);
+	}
+
+	if(nested)
+	{
+		set_hook_enable(hook);
 	}
 }
 
-void Fiber::yield()  //让出当前协程的执行权限，返回主协程或调度协程
+void Fiber::yield(WaitState reason)  //让出当前协程的执行权限，返回resume它的协程（通常是主协程或调度协程）
 {
 	assert(m_state==RUNNING || m_state==TERM);
+	assert(m_resumer != nullptr);
 
 	if(m_state!=TERM)
 	{
 		m_state = READY;
+		suspendAs(reason);
 	}
 
-	if(m_runInScheduler)
+	if(t_next && m_resumer == t_scheduler_fiber && t_switch_count < MAX_SWITCH_CHAIN)
 	{
-		SetThis(t_scheduler_fiber);
-		if(swapcontext(&m_ctx, &(t_scheduler_fiber->m_ctx)))
+		RefPtr<Fiber> next = std::move(t_next);
+		// 已被空闲线程取走 -> 正常回到调度协程
+		if(Scheduler::GetThis()->takeTask(next.get()))
 		{
-			std::cerr << "yield() to to t_scheduler_fiber failed\n";
-			pthread_exit(NULL);
-		}		
+			if(switchTo(next, false))
+			{
+				return;
+			}
+			Scheduler::GetThis()->scheduleLock(next);
+		}
 	}
-	else
+
+	Fiber* resumer = m_resumer;
+	m_resumer = nullptr;
+	SetThis(resumer);
+	if(Swap(this, resumer))
+	{
+		std::cerr << "yield() failed\n";
+		pthread_exit(NULL);
+	}
+}
+
+void Fiber::yieldNow()
+{
+	assert(t_fiber == this);
+
+	Scheduler* scheduler = Scheduler::GetThis();
+	if(!scheduler || !m_runInScheduler || m_resumer != t_scheduler_fiber)
+	{
+		return;
+	}
+	// 在yield完成之前被其他线程取出也没有问题：它会留下待唤醒标记，由本线程释放运行权时重新调度
+	scheduler->scheduleLock(RefPtr<Fiber>(this));
+	yield();
+}
+
+bool Fiber::switchTo(RefPtr<Fiber> target, bool requeue)
+{
+	assert(t_fiber == this && target.get() != this);
+
+	Scheduler* scheduler = Scheduler::GetThis();
+	if(!scheduler || !m_runInScheduler || !target->m_runInScheduler || m_resumer != t_scheduler_fiber)
 	{
-		SetThis(t_thread_fiber.get());
-		if(swapcontext(&m_ctx, &(t_thread_fiber->m_ctx)))
+		return false;
+	}
+
+	if(t_switched.empty())
+	{
+		t_root = this;
+	}
+	// 本线程已经持有运行权的协程（t_root和之前切换过的）都已完成yield，直接切换
+	bool held = target.get() == t_root || std::find(t_switched.begin(), t_switched.end(), target) != t_switched.end();
+	if(!held && !target->tryOwn())
+	{
+		// target还没有在其他线程上完成yield -> 不等待，由调用者放入任务队列
+		return false;
+	}
+	if(target->m_state != READY)
+	{
+		if(!held && target->disown())
 		{
-			std::cerr << "yield() to t_thread_fiber failed\n";
-			pthread_exit(NULL);
-		}	
-	}	
+			scheduler->scheduleLock(target);
+		}
+		return false;
+	}
+	if(!held)
+	{
+		t_switched.push_back(target);
+	}
+	t_switch_count++;
+
+	if(requeue)
+	{
+		// 其他线程在控制权回到本线程的调度协程之前取出本协程 -> 推迟到本线程释放运行权时
+		scheduler->scheduleLock(RefPtr<Fiber>(this));
+	}
+
+	if(m_state != TERM)
+	{
+		m_state = READY;
+		suspendAs(SUSPENDED);
+	}
+	target->m_state = RUNNING;
+	target->setWaitState(WAIT_NONE);
+	target->m_resumer = m_resumer;
+	target->m_budget = s_yield_budget.load(std::memory_order_relaxed);
+	Fiber* raw = target.get();
+	target.reset();
+	SetThis(raw);
+	// target之后yield()时回到调度协程，就像调度协程resume了它一样
+	if(Swap(this, raw))
+	{
+		std::cerr << "switchTo() failed\n";
+		pthread_exit(NULL);
+	}
+	return true;
+}
+
+bool Fiber::SetNext(RefPtr<Fiber> f)
+{
+	Scheduler* scheduler = Scheduler::GetThis();
+	if(!scheduler || !t_fiber || t_fiber->m_resumer != t_scheduler_fiber || !t_fiber->m_runInScheduler || !f->m_runInScheduler)
+	{
+		return false;
+	}
+	// 先放入任务队列：唤醒者之后没有挂起（继续计算、阻塞在未hook的调用中）时，其他线程仍然可以运行f
+	t_next = f;
+	scheduler->scheduleLock(std::move(f));
+	return true;
+}
+
+bool Fiber::tryOwn()
+{
+	uint32_t expected = 0;
+	return m_owner.compare_exchange_strong(expected, OWNED, std::memory_order_acquire, std::memory_order_relaxed);
+}
+
+bool Fiber::ownOrDefer()
+{
+	uint32_t state = m_owner.load(std::memory_order_relaxed);
+	while(true)
+	{
+		// 持有者释放（置0）与设置标记竞争 -> CAS循环，二者必有其一成功
+		uint32_t desired = (state & OWNED) ? (state | PENDING_WAKE) : OWNED;
+		if(m_owner.compare_exchange_weak(state, desired, std::memory_order_acq_rel, std::memory_order_relaxed))
+		{
+			return !(state & OWNED);
+		}
+	}
+}
+
+bool Fiber::disown()
+{
+	// release：其他线程取得运行权后能看到本线程保存的上下文和状态
+	return m_owner.exchange(0, std::memory_order_acq_rel) & PENDING_WAKE;
+}
+
+void Fiber::ReleaseSwitched()
+{
+	Scheduler* scheduler = Scheduler::GetThis();
+	for(auto& f : t_switched)
+	{
+		if(f->disown())
+		{
+			scheduler->scheduleLock(std::move(f));
+		}
+	}
+	t_switched.clear();
+	t_root = nullptr;
+	t_switch_count = 0;
+	// 记录的协程一直在任务队列中
+	t_next = nullptr;
+}
+
+int Fiber::Swap(Fiber* from, Fiber* to)
+{
+#ifdef SYLAR_FIBER_STATS
+	// 每次切换只读一次时钟：既是from本次运行的结束，也是to的开始
+	uint64_t now = Ticks();
+	from->m_cpuTicks.store(from->m_cpuTicks.load(std::memory_order_relaxed) + (now - from->m_runStart), std::memory_order_relaxed);
+	if(from->m_state == TERM)
+	{
+		AccountFinished(from);
+	}
+	to->m_runStart = now;
+	to->m_switches.store(to->m_switches.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	uint64_t enqueued = to->m_enqueueTicks.load(std::memory_order_relaxed);
+	if(enqueued)
+	{
+		to->m_enqueueTicks.store(0, std::memory_order_relaxed);
+		uint64_t delay = now > enqueued ? now - enqueued : 0;
+		to->m_delayTicks.store(to->m_delayTicks.load(std::memory_order_relaxed) + delay, std::memory_order_relaxed);
+		if(delay > to->m_maxDelayTicks.load(std::memory_order_relaxed))
+		{
+			to->m_maxDelayTicks.store(delay, std::memory_order_relaxed);
+		}
+	}
+#endif
+	if(Tracer::Enabled() && (Tracer::Sampled(from->m_id) || Tracer::Sampled(to->m_id)))
+	{
+		Tracer::Record(Tracer::SWITCH, to->m_id, from->m_id, from->m_waitState.load(std::memory_order_relaxed));
+	}
+	// to开始运行（序号变为奇数），之后它的栈会被修改
+	to->m_runSeq.store(to->m_runSeq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	t_prev = from;
+	int rt = swapcontext(&from->m_ctx, &to->m_ctx);
+	FinishSwitch();
+	return rt;
+}
+
+void Fiber::FinishSwitch()
+{
+	Fiber* prev = t_prev;
+	t_prev = nullptr;
+	if(prev)
+	{
+		// 上一个协程的上下文已经保存完毕（序号变回偶数），此后Snapshot()可以展开它的栈
+		prev->m_runSeq.store(prev->m_runSeq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+}
+
+uint64_t Fiber::WaitClockMs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+void Fiber::setWaitState(WaitState s)
+{
+	m_waitState.store(s, std::memory_order_relaxed);
+	if(s != WAIT_NONE)
+	{
+		m_waitSince.store(WaitClockMs(), std::memory_order_relaxed);
+	}
+}
+
+void Fiber::suspendAs(WaitState reason)
+{
+	// 唤醒者可能已经在yield之前把协程放入任务队列（RUNNABLE），此时不能覆盖
+	int expected = WAIT_NONE;
+	if(m_waitState.compare_exchange_strong(expected, reason, std::memory_order_relaxed))
+	{
+		m_waitSince.store(WaitClockMs(), std::memory_order_relaxed);
+	}
+}
+
+void Fiber::markRunnable()
+{
+	setWaitState(RUNNABLE);
+#ifdef SYLAR_FIBER_STATS
+	m_enqueueTicks.store(Ticks(), std::memory_order_relaxed);
+#endif
+}
+
+void Fiber::SetTaskName(const char* name)
+{
+#ifdef SYLAR_FIBER_STATS
+	if(t_fiber)
+	{
+		t_fiber->m_taskName = name;
+	}
+#else
+	(void)name;
+#endif
+}
+
+void Fiber::SetYieldBudget(uint32_t n)
+{
+	s_yield_budget = n;
+}
+
+uint32_t Fiber::GetYieldBudget()
+{
+	return s_yield_budget;
+}
+
+void Fiber::ConsumeBudget()
+{
+	Fiber* curr = t_fiber;
+	if(!curr || curr->m_budget == 0)
+	{
+		return;
+	}
+	if(--curr->m_budget == 0)
+	{
+		// 恢复后可能在另一个线程上 -> 保存errno
+		int err = errno;
+		curr->yieldNow();
+		errno = err;
+	}
 }
 
 void Fiber::MainFunc()
 {
-	std::shared_ptr<Fiber> curr = GetThis();
+	// 第一次切换到本协程，没有经过Swap()的返回
+	FinishSwitch();
+
+	// 不持有引用：resume本协程的一方（Scheduler::run、等待者）保证协程在运行期间存活，
+	// 协程结束后的yield()不会返回，栈上的强引用永远不会释放
+	Fiber* curr = Current();
 	assert(curr!=nullptr);
+	if(Tracer::Enabled() && Tracer::Sampled(curr->m_id))
+	{
+		Tracer::Record(Tracer::FIBER_START, curr->m_id, (uintptr_t)curr->m_entry.load(std::memory_order_relaxed));
+	}
 
 	curr->m_cb(); 
 	curr->m_cb = nullptr;
+	// 在协程栈上销毁协程局部存储，析构函数中仍然可以访问当前协程
+	curr->clearLocals();
 	curr->m_state = TERM;
 
 	// 运行完毕 -> 让出执行权
-	auto raw_ptr = curr.get();   //用于返回它所管理的原始指针。这个函数不会影响引用计数，也不会释放对象
-	curr.reset();     //curr的引用计数减一
-	raw_ptr->yield(); 
+	curr->yield(); 
 }
 
 }
\ No newline at end of file
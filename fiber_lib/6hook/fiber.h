@@ -9,10 +9,50 @@
 #include <ucontext.h>   
 #include <unistd.h>
 #include <mutex>
+#include <vector>
+#include <string>
+#include <csignal>
+#include <typeinfo>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+#include "inplace_function.h"
+#include "ref_ptr.h"
 
 namespace sylar {
 
-class Fiber : public std::enable_shared_from_this<Fiber>
+class CancelToken;
+
+// 固定大小的协程栈缓存：协程析构时栈放回空闲列表，之后创建的协程直接取用，省去malloc/free
+// 必须比使用它的协程活得久 -> 通常为全局对象
+class StackPool
+{
+public:
+	StackPool(size_t stacksize, size_t max_cached = 256);
+	~StackPool();
+
+	StackPool(const StackPool&) = delete;
+	StackPool& operator=(const StackPool&) = delete;
+
+	void* acquire();
+	void release(void* stack);
+
+	size_t getStackSize() const {return m_stacksize;}
+
+private:
+	size_t m_stacksize;
+	// 最多缓存的空闲栈数，超过时直接释放
+	size_t m_maxCached;
+	std::mutex m_mutex;
+	std::vector<void*> m_free;
+};
+
+// 协程由侵入式引用计数管理：RefPtr<Fiber>(new Fiber(...))
+class Fiber : public RefCounted<Fiber>
 {
 public:
 	// 协程状态
@@ -23,31 +63,127 @@ public:
 		TERM 
 	};
 
+	// 细分的等待状态，只用于观察（注册表、Dump）：READY的协程挂起在哪里
+	enum WaitState
+	{
+		WAIT_NONE,         // 运行中，或恢复后还没有挂起
+		RUNNABLE,          // 已被唤醒，在任务队列中等待运行
+		SUSPENDED,         // 其他原因挂起：嵌套子协程、生成器、卸载、直接调用yield()等
+		SUSPENDED_IO,      // 等待fd事件
+		SUSPENDED_TIMER,   // sleep系列
+		SUSPENDED_SYNC     // 互斥量、条件变量、通道、Future等同步原语
+	};
+
+	// 注册表中一个协程的快照
+	struct Info
+	{
+		uint64_t id;
+		// RUNNING、TERM或WaitState的名字
+		const char* state;
+		// 进入当前等待状态以来的毫秒数（粗粒度时钟），运行中为0
+		uint64_t waitMs;
+		// 协程函数的类型（反修饰后），lambda的类型名包含定义它的函数 -> 相当于创建位置
+		std::string entry;
+		// 挂起处的调用栈（返回地址），运行中或无法展开时为空
+		std::vector<void*> backtrace;
+	};
+
+	// 按任务类型汇总的运行统计
+	// 只在编译时定义SYLAR_FIBER_STATS时收集（每次切换一次rdtsc），未定义时相关代码全部编译掉
+	struct TaskStats
+	{
+		// SetTaskName()设置的名字，未设置时为协程函数的类型
+		std::string name;
+		// 已结束的任务数
+		uint64_t count = 0;
+		// 运行时间：每次恢复到让出之间的时钟时间之和，包括其中阻塞线程的系统调用
+		uint64_t cpuNs = 0;
+		// 被恢复运行的次数
+		uint64_t switches = 0;
+		// 放入任务队列到开始运行的延迟
+		uint64_t delayNs = 0;
+		uint64_t maxDelayNs = 0;
+	};
+
 private:
 	// 仅由GetThis()调用 -> 私有 -> 创建主协程  
 	Fiber();
 
 public:
-	Fiber(std::function<void()> cb, size_t stacksize = 0, bool run_in_scheduler = true);
+	// pool不为空时从中取得协程栈（忽略stacksize），析构时归还
+	Fiber(Callback cb, size_t stacksize = 0, bool run_in_scheduler = true, StackPool* pool = nullptr);
 	~Fiber();
 
 	// 重用一个协程
-	void reset(std::function<void()> cb);
+	void reset(Callback cb);
 
-	// 任务线程恢复执行
+	// 恢复执行：可以由主协程、调度协程或任意正在运行的协程调用（嵌套），记录调用者
+	// 嵌套的子协程运行期间关闭hook -> 其中的阻塞调用不会挂起，而是直接阻塞线程
 	void resume();
-	// 任务线程让出执行权
-	void yield();
+	// 让出执行权，回到resume本协程的协程 -> 每个线程上的协程构成一个调用栈
+	// reason只用于观察：挂起前已被唤醒（RUNNABLE）时保持不变
+	void yield(WaitState reason = SUSPENDED);
+	// 让出执行权并把自己放回调度器任务队列的末尾，用于计算密集的协程主动与同一线程上的其他协程分享CPU
+	// 只能由当前协程调用，不在调度器中时直接返回
+	void yieldNow();
+	// 直接切换到target，不经过调度协程：省去一次swapcontext和一次任务队列的加锁
+	// requeue为true时当前协程放回调度器队列末尾，否则由调用者保证之后会被唤醒（如已加入等待队列）
+	// target必须是调用者独占唤醒权的挂起协程（如刚从等待队列中取出），不能同时被scheduleLock
+	// 返回false表示无法切换（不在调度器中或target不是READY），调用者应改用scheduleLock
+	bool switchTo(RefPtr<Fiber> target, bool requeue = true);
 
 	uint64_t getId() const {return m_id;}
 	State getState() const {return m_state;}
+	WaitState getWaitState() const {return (WaitState)m_waitState.load(std::memory_order_relaxed);}
+	// 放入任务队列时由调度器调用
+	void markRunnable();
+
+#ifdef SYLAR_FIBER_STATS
+	uint64_t getCpuNs() const {return TicksToNs(m_cpuTicks.load(std::memory_order_relaxed));}
+	uint64_t getSwitches() const {return m_switches.load(std::memory_order_relaxed);}
+	uint64_t getDelayNs() const {return TicksToNs(m_delayTicks.load(std::memory_order_relaxed));}
+	// 回调任务在Scheduler::run中才得到协程 -> 由调度器传入任务的入队时刻
+	void setEnqueueTicks(uint64_t t) {m_enqueueTicks.store(t, std::memory_order_relaxed);}
+#endif
+
+	// 统计和调度器指标使用的时钟：x86上为TSC
+	static uint64_t Ticks()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+	static uint64_t TicksToNs(uint64_t ticks);
+
+	// 运行权：调度器中同一时刻只有一个线程可以resume协程，代替原来在resume()期间持有的互斥锁
+	// 唤醒（scheduleLock）可能发生在协程完成yield之前，此时取出它的线程不能等待，而是留下待唤醒标记，
+	// 由持有运行权的线程在释放时重新放回任务队列 -> 唤醒不会丢失，也不会两个线程同时resume
+	// 取得运行权，协程正被其他线程持有时返回false
+	bool tryOwn();
+	// 取得运行权；正被其他线程持有时设置待唤醒标记并返回false，持有者释放时负责重新调度
+	bool ownOrDefer();
+	// 释放运行权，返回期间是否有被推迟的唤醒（调用者应重新调度协程）
+	bool disown();
+
+	// 协程所属的取消令牌（TaskGroup），hook的阻塞调用据此响应取消
+	void setCancelToken(CancelToken* token) {m_cancelToken = token;}
+
+	// 协程局部存储的槽位，未分配时返回nullptr
+	void* getLocal(size_t index) const {return index < m_locals.size() ? m_locals[index].value : nullptr;}
+	// 设置槽位的值，旧值被销毁，destroy在协程结束（TERM）、reset()或析构时调用
+	void setLocal(size_t index, void* value, void (*destroy)(void*));
 
 public:
 	// 设置当前运行的协程
 	static void SetThis(Fiber *f);
 
 	// 得到当前运行的协程 
-	static std::shared_ptr<Fiber> GetThis();
+	static RefPtr<Fiber> GetThis();
+	// 当前运行的协程的裸指针，不增加引用计数：只在本协程中使用（yield()、设置令牌等）时用它
+	// 需要在挂起期间保持协程存活（交给事件、定时器、等待队列）时才用GetThis()
+	static Fiber* Current();
 
 	// 设置调度协程（默认为主协程）
 	static void SetSchedulerFiber(Fiber* f);
@@ -55,9 +191,73 @@ public:
 	// 得到当前运行的协程id
 	static uint64_t GetFiberId();
 
+	// 得到当前运行的协程的取消令牌，没有时返回nullptr
+	static CancelToken* GetCancelToken();
+
+	// 协作式预算：每次resume()后协程最多连续完成n次不需要等待的hook IO，之后自动yieldNow()
+	// 防止一个数据源源不断的连接饿死同一线程上的其他协程，0表示关闭
+	static void SetYieldBudget(uint32_t n);
+	static uint32_t GetYieldBudget();
+	// hook IO未挂起而直接完成时调用，预算耗尽则yieldNow()，保留errno
+	static void ConsumeBudget();
+
 	// 协程函数
 	static void MainFunc();	
 
+	// 唤醒挂起的协程f：放入任务队列（空闲线程可以立即取走它），并记录下来；当前协程下一次yield()时
+	// 如果f仍在队列中，就把它取回并直接switchTo(f) -> 唤醒者马上挂起时（如无缓冲通道的一问一答）省去经过调度协程的切换，
+	// 唤醒者继续计算或阻塞时f也不会被困在本线程上；只记录最近一次
+	// 调用者必须独占f的唤醒权；返回false表示当前不在调度器的任务协程中，调用者应改用scheduleLock
+	static bool SetNext(RefPtr<Fiber> f);
+
+	// 由Scheduler::run在resume()返回后调用：释放switchTo()过程中持有的目标协程，清除SetNext()的记录
+	static void ReleaseSwitched();
+
+	// 当前所有存活协程（包括各线程的主协程、调度协程和idle协程）的快照
+	// backtrace为true时展开挂起协程保存的上下文：沿帧指针回溯，优化编译时需要-fno-omit-frame-pointer才完整（仅x86_64）
+	static std::vector<Info> Snapshot(bool backtrace = true);
+	// 把快照以文本形式写入os，用于排查卡住的请求
+	static void Dump(std::ostream& os);
+	// 收到signo时在后台线程中Dump到标准错误，如 kill -USR2 <pid>；只需调用一次
+	static bool InstallDumpSignal(int signo = SIGUSR2);
+	// 等待状态的名字和协程函数类型的可读名字（主协程为"main"），用于Dump()和跟踪输出
+	static const char* WaitStateName(WaitState s);
+	static std::string EntryName(const std::type_info* entry);
+
+	// 给当前任务命名，同名任务汇总在一起；name必须是静态字符串（只保存指针），协程重用时清空
+	static void SetTaskName(const char* name);
+	// 按任务名（或协程函数类型）汇总的已结束任务的统计，未开启SYLAR_FIBER_STATS时为空
+	static std::vector<TaskStats> GetTaskStats();
+	static void ResetTaskStats();
+
+	// 分配一个协程局部存储的槽位下标，由FiberLocal在构造时调用
+	static size_t RegisterLocal();
+	// 当前协程的槽位，直接读取t_fiber，不增加引用计数
+	static void* GetLocal(size_t index);
+	static void SetLocal(size_t index, void* value, void (*destroy)(void*));
+
+private:
+	// 销毁所有协程局部存储
+	void clearLocals();
+
+	// 保存from的上下文并切换到to，所有swapcontext都经过这里以维护m_runSeq
+	static int Swap(Fiber* from, Fiber* to);
+	// 切换完成后在新的上下文中调用：上一个协程的上下文已经保存完毕
+	static void FinishSwitch();
+
+	// 加入/移出存活协程的注册表
+	static void Register(Fiber* f);
+	static void Unregister(Fiber* f);
+	// 任务结束时把统计汇总到本线程的表中
+	static void AccountFinished(Fiber* f);
+
+	// 记录等待状态及其开始时间
+	void setWaitState(WaitState s);
+	// 即将挂起：还没有被唤醒（WAIT_NONE）时记录原因
+	void suspendAs(WaitState reason);
+	// 等待时长使用的粗粒度单调时钟（毫秒），读取只需几纳秒
+	static uint64_t WaitClockMs();
+
 private:
 	// id
 	uint64_t m_id = 0;
@@ -70,13 +270,55 @@ private:
 	ucontext_t m_ctx;
 	// 协程栈指针
 	void* m_stack = nullptr;
+	// 协程栈来自的缓存池，为空时由malloc分配
+	StackPool* m_pool = nullptr;
 	// 协程函数
-	std::function<void()> m_cb;
-	// 是否让出执行权交给调度协程
+	Callback m_cb;
+	// 是否由调度器调度：只有这样的协程才能被yieldNow()放回任务队列、被switchTo()切换
 	bool m_runInScheduler;
+	// resume本协程的协程，yield()时切换回它
+	Fiber* m_resumer = nullptr;
+	// 取消令牌，由TaskGroup设置
+	CancelToken* m_cancelToken = nullptr;
+	// 本次resume()剩余的协作式预算
+	uint32_t m_budget = 0;
 
-public:
-	std::mutex m_mutex;
+	// 协程局部存储，按FiberLocal的下标索引，第一次设置时才分配
+	struct LocalSlot
+	{
+		void* value = nullptr;
+		void (*destroy)(void*) = nullptr;
+	};
+	std::vector<LocalSlot> m_locals;
+
+	// 运行权的状态位，与m_owner同类型 -> 条件表达式中不混用枚举和整数
+	static const uint32_t OWNED = 1;
+	static const uint32_t PENDING_WAKE = 2;
+	std::atomic<uint32_t> m_owner{0};
+
+	// 观察用的状态，可以被Snapshot()从其他线程读取
+	// 运行序号：协程开始运行时加1（奇数），上下文保存完毕后再加1（偶数） -> 展开栈前后序号不变说明期间没有运行
+	std::atomic<uint32_t> m_runSeq{0};
+	std::atomic<int> m_waitState{WAIT_NONE};
+	std::atomic<uint64_t> m_waitSince{0};
+	// 协程函数的类型，主协程为空
+	std::atomic<const std::type_info*> m_entry{nullptr};
+	// 注册表中的链表指针，由注册表的锁保护
+	Fiber* m_regPrev = nullptr;
+	Fiber* m_regNext = nullptr;
+
+#ifdef SYLAR_FIBER_STATS
+	// 只由运行本协程的线程写入，原子变量只为了让GetTaskStats()之外的读取者（getCpuNs()等）没有数据竞争
+	std::atomic<uint64_t> m_cpuTicks{0};
+	std::atomic<uint64_t> m_switches{0};
+	std::atomic<uint64_t> m_delayTicks{0};
+	std::atomic<uint64_t> m_maxDelayTicks{0};
+	// 本次开始运行的时刻
+	uint64_t m_runStart = 0;
+	// 放入任务队列的时刻，0表示不在队列中
+	std::atomic<uint64_t> m_enqueueTicks{0};
+	const char* m_taskName = nullptr;
+#endif
 };
 
 }
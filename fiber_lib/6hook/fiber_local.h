@@ -0,0 +1,68 @@
+#ifndef _FIBER_LOCAL_H_
+#define _FIBER_LOCAL_H_
+
+#include "fiber.h"
+
+namespace sylar {
+
+// 协程局部存储：每个协程一份，随协程在工作线程之间迁移（thread_local在协程换线程后会读到别的值）
+// 构造时分配一个全局槽位下标，访问时直接按下标读取当前协程的槽位数组，没有哈希查找
+// 值在第一次get()时默认构造，在协程结束（TERM）、reset()或析构时销毁
+// 槽位下标不会回收 -> 应定义为全局或静态变量
+//
+// static sylar::FiberLocal<std::string> t_trace_id;
+// *t_trace_id = "abc";
+template<class T>
+class FiberLocal
+{
+public:
+	FiberLocal(): m_index(Fiber::RegisterLocal()) {}
+
+	FiberLocal(const FiberLocal&) = delete;
+	FiberLocal& operator=(const FiberLocal&) = delete;
+
+	// 当前协程的值，不存在时默认构造
+	T& get()
+	{
+		T* value = (T*)Fiber::GetLocal(m_index);
+		if(!value)
+		{
+			value = new T();
+			Fiber::SetLocal(m_index, value, &FiberLocal::Destroy);
+		}
+		return *value;
+	}
+
+	// 当前协程的值，不存在时返回nullptr
+	T* tryGet()
+	{
+		return (T*)Fiber::GetLocal(m_index);
+	}
+
+	void set(T value)
+	{
+		Fiber::SetLocal(m_index, new T(std::move(value)), &FiberLocal::Destroy);
+	}
+
+	// 提前销毁当前协程的值
+	void reset()
+	{
+		Fiber::SetLocal(m_index, nullptr, nullptr);
+	}
+
+	T& operator*() {return get();}
+	T* operator->() {return &get();}
+
+private:
+	static void Destroy(void* p)
+	{
+		delete (T*)p;
+	}
+
+private:
+	const size_t m_index;
+};
+
+}
+
+#endif
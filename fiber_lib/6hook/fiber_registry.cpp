@@ -0,0 +1,389 @@
+#include "fiber.h"
+#include "thread.h"
+#include "hook.h"
+
+#include <algorithm>
+#include <cxxabi.h>
+#include <execinfo.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <ucontext.h>
+#include <chrono>
+#include <unordered_map>
+
+namespace sylar {
+
+// 存活协程的注册表：按id分片，每片一个互斥锁和一条侵入式双向链表
+// 只在协程创建和销毁时加锁 -> 切换、唤醒不受影响
+struct RegistryShard
+{
+	std::mutex mutex;
+	Fiber* head = nullptr;
+};
+
+static const size_t REGISTRY_SHARDS = 16;
+static RegistryShard s_registry[REGISTRY_SHARDS];
+
+// 展开时最多记录的栈帧数
+static const size_t MAX_FRAMES = 64;
+
+void Fiber::Register(Fiber* f)
+{
+	RegistryShard& shard = s_registry[f->m_id % REGISTRY_SHARDS];
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	f->m_regPrev = nullptr;
+	f->m_regNext = shard.head;
+	if(shard.head)
+	{
+		shard.head->m_regPrev = f;
+	}
+	shard.head = f;
+}
+
+void Fiber::Unregister(Fiber* f)
+{
+	RegistryShard& shard = s_registry[f->m_id % REGISTRY_SHARDS];
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	if(f->m_regPrev)
+	{
+		f->m_regPrev->m_regNext = f->m_regNext;
+	}
+	else
+	{
+		shard.head = f->m_regNext;
+	}
+	if(f->m_regNext)
+	{
+		f->m_regNext->m_regPrev = f->m_regPrev;
+	}
+	f->m_regPrev = f->m_regNext = nullptr;
+}
+
+// 从保存的上下文沿帧指针回溯，只读取[lo, hi)之内的内存
+static size_t UnwindContext(const ucontext_t& ctx, uintptr_t lo, uintptr_t hi, void** frames, size_t max)
+{
+#if defined(__x86_64__)
+	uintptr_t pc = ctx.uc_mcontext.gregs[REG_RIP];
+	uintptr_t fp = ctx.uc_mcontext.gregs[REG_RBP];
+	size_t n = 0;
+	while(n < max && pc)
+	{
+		frames[n++] = (void*)pc;
+		// 帧指针不在协程栈内（如被优化掉）时停止
+		if(fp < lo || fp + 2 * sizeof(uintptr_t) > hi || (fp & (sizeof(uintptr_t) - 1)))
+		{
+			break;
+		}
+		uintptr_t next = ((uintptr_t*)fp)[0];
+		pc = ((uintptr_t*)fp)[1];
+		// 栈向低地址增长 -> 调用者的帧一定在更高处，防止成环
+		if(next <= fp)
+		{
+			break;
+		}
+		fp = next;
+	}
+	return n;
+#else
+	(void)ctx; (void)lo; (void)hi; (void)frames; (void)max;
+	return 0;
+#endif
+}
+
+static std::string Demangle(const char* name)
+{
+	int status = 0;
+	char* buf = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+	if(status != 0 || !buf)
+	{
+		return name;
+	}
+	std::string rt(buf);
+	free(buf);
+	return rt;
+}
+
+const char* Fiber::WaitStateName(WaitState s)
+{
+	switch(s)
+	{
+	case Fiber::RUNNABLE:
+		return "RUNNABLE";
+	case Fiber::SUSPENDED_IO:
+		return "SUSPENDED_IO";
+	case Fiber::SUSPENDED_TIMER:
+		return "SUSPENDED_TIMER";
+	case Fiber::SUSPENDED_SYNC:
+		return "SUSPENDED_SYNC";
+	default:
+		// WAIT_NONE的挂起协程：正在resume子协程的主协程、调度协程等
+		return "SUSPENDED";
+	}
+}
+
+std::string Fiber::EntryName(const std::type_info* entry)
+{
+	return entry ? Demangle(entry->name()) : "main";
+}
+
+std::vector<Fiber::Info> Fiber::Snapshot(bool backtrace)
+{
+	std::vector<Info> infos;
+	std::vector<const std::type_info*> entries;
+	uint64_t now = WaitClockMs();
+
+	for(RegistryShard& shard : s_registry)
+	{
+		// 持有锁期间链表中的协程不会被销毁，可以读取它的栈
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		for(Fiber* f = shard.head; f; f = f->m_regNext)
+		{
+			Info info;
+			info.id = f->m_id;
+			info.waitMs = 0;
+			entries.push_back(f->m_entry.load(std::memory_order_relaxed));
+
+			uint32_t seq = f->m_runSeq.load(std::memory_order_acquire);
+			if(seq & 1)
+			{
+				info.state = "RUNNING";
+				infos.push_back(std::move(info));
+				continue;
+			}
+
+			WaitState ws = (WaitState)f->m_waitState.load(std::memory_order_relaxed);
+			uint64_t since = f->m_waitSince.load(std::memory_order_relaxed);
+			info.state = WaitStateName(ws);
+			info.waitMs = (ws != WAIT_NONE && now > since) ? now - since : 0;
+
+			if(backtrace && f->m_stack)
+			{
+				void* frames[MAX_FRAMES];
+				uintptr_t lo = (uintptr_t)f->m_stack;
+				size_t n = UnwindContext(f->m_ctx, lo, lo + f->m_stacksize, frames, MAX_FRAMES);
+				// 展开期间协程被其他线程恢复运行 -> 结果不可信，丢弃
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if(f->m_runSeq.load(std::memory_order_relaxed) == seq)
+				{
+					info.backtrace.assign(frames, frames + n);
+				}
+			}
+			// 状态在展开之后读取：TERM的协程不会再运行
+			if(f->m_state == TERM)
+			{
+				info.state = "TERM";
+				info.waitMs = 0;
+				info.backtrace.clear();
+			}
+			infos.push_back(std::move(info));
+		}
+	}
+
+	// 反修饰需要分配内存，放到锁外
+	for(size_t i = 0; i < infos.size(); i++)
+	{
+		infos[i].entry = EntryName(entries[i]);
+	}
+	return infos;
+}
+
+void Fiber::Dump(std::ostream& os)
+{
+	std::vector<Info> infos = Snapshot(true);
+	os << "==== " << infos.size() << " fibers ====\n";
+	for(auto& info : infos)
+	{
+		os << "fiber " << info.id << " " << info.state;
+		if(info.waitMs)
+		{
+			os << " for " << info.waitMs << "ms";
+		}
+		os << " entry=" << info.entry << "\n";
+
+		if(info.backtrace.empty())
+		{
+			continue;
+		}
+		char** symbols = backtrace_symbols(info.backtrace.data(), info.backtrace.size());
+		for(size_t i = 0; i < info.backtrace.size(); i++)
+		{
+			os << "    #" << i << " " << (symbols ? symbols[i] : "?") << "\n";
+		}
+		free(symbols);
+	}
+	os.flush();
+}
+
+#ifdef SYLAR_FIBER_STATS
+// 一种任务的累计值，单位为时钟周期
+struct TaskAccum
+{
+	const char* name = nullptr;
+	const std::type_info* type = nullptr;
+	uint64_t count = 0;
+	uint64_t cpuTicks = 0;
+	uint64_t switches = 0;
+	uint64_t delayTicks = 0;
+	uint64_t maxDelayTicks = 0;
+};
+
+// 每个线程一张表，任务结束时只锁本线程的表（几乎没有竞争），GetTaskStats()时合并
+// 表在线程退出后保留 -> 已结束线程上的统计不会丢失
+struct TaskTable
+{
+	std::mutex mutex;
+	// 键为任务名指针，未命名时为协程函数的type_info
+	std::unordered_map<const void*, TaskAccum> tasks;
+};
+
+static std::mutex s_tablesMutex;
+static std::vector<TaskTable*> s_tables;
+static thread_local TaskTable* t_table = nullptr;
+
+void Fiber::AccountFinished(Fiber* f)
+{
+	if(!t_table)
+	{
+		t_table = new TaskTable();
+		std::lock_guard<std::mutex> lock(s_tablesMutex);
+		s_tables.push_back(t_table);
+	}
+	const std::type_info* type = f->m_entry.load(std::memory_order_relaxed);
+	const void* key = f->m_taskName ? (const void*)f->m_taskName : (const void*)type;
+
+	std::lock_guard<std::mutex> lock(t_table->mutex);
+	TaskAccum& acc = t_table->tasks[key];
+	acc.name = f->m_taskName;
+	acc.type = type;
+	acc.count++;
+	acc.cpuTicks += f->m_cpuTicks.load(std::memory_order_relaxed);
+	acc.switches += f->m_switches.load(std::memory_order_relaxed);
+	acc.delayTicks += f->m_delayTicks.load(std::memory_order_relaxed);
+	acc.maxDelayTicks = std::max(acc.maxDelayTicks, f->m_maxDelayTicks.load(std::memory_order_relaxed));
+}
+#endif
+
+uint64_t Fiber::TicksToNs(uint64_t ticks)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	// 第一次使用时用单调时钟校准TSC频率（约10ms）
+	static const double s_nsPerTick = []() {
+		auto t0 = std::chrono::steady_clock::now();
+		uint64_t c0 = Ticks();
+		usleep_f(10000);
+		uint64_t c1 = Ticks();
+		auto t1 = std::chrono::steady_clock::now();
+		double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+		return c1 > c0 ? ns / (c1 - c0) : 1.0;
+	}();
+	return (uint64_t)(ticks * s_nsPerTick);
+#else
+	return ticks;
+#endif
+}
+
+std::vector<Fiber::TaskStats> Fiber::GetTaskStats()
+{
+	std::vector<TaskStats> rt;
+#ifdef SYLAR_FIBER_STATS
+	std::unordered_map<const void*, TaskAccum> merged;
+	{
+		std::lock_guard<std::mutex> lock(s_tablesMutex);
+		for(TaskTable* table : s_tables)
+		{
+			std::lock_guard<std::mutex> table_lock(table->mutex);
+			for(auto& i : table->tasks)
+			{
+				TaskAccum& acc = merged[i.first];
+				acc.name = i.second.name;
+				acc.type = i.second.type;
+				acc.count += i.second.count;
+				acc.cpuTicks += i.second.cpuTicks;
+				acc.switches += i.second.switches;
+				acc.delayTicks += i.second.delayTicks;
+				acc.maxDelayTicks = std::max(acc.maxDelayTicks, i.second.maxDelayTicks);
+			}
+		}
+	}
+	for(auto& i : merged)
+	{
+		TaskStats stats;
+		const TaskAccum& acc = i.second;
+		stats.name = acc.name ? acc.name : EntryName(acc.type);
+		stats.count = acc.count;
+		stats.cpuNs = TicksToNs(acc.cpuTicks);
+		stats.switches = acc.switches;
+		stats.delayNs = TicksToNs(acc.delayTicks);
+		stats.maxDelayNs = TicksToNs(acc.maxDelayTicks);
+		rt.push_back(std::move(stats));
+	}
+	// 最耗CPU的任务在前
+	std::sort(rt.begin(), rt.end(), [](const TaskStats& a, const TaskStats& b) {return a.cpuNs > b.cpuNs;});
+#endif
+	return rt;
+}
+
+void Fiber::ResetTaskStats()
+{
+#ifdef SYLAR_FIBER_STATS
+	std::lock_guard<std::mutex> lock(s_tablesMutex);
+	for(TaskTable* table : s_tables)
+	{
+		std::lock_guard<std::mutex> table_lock(table->mutex);
+		table->tasks.clear();
+	}
+#endif
+}
+
+// 信号处理函数只向管道写一个字节（异步信号安全），由后台线程完成Dump
+static int s_dumpPipe[2] = {-1, -1};
+
+static void OnDumpSignal(int)
+{
+	int err = errno;
+	char c = 0;
+	write_f(s_dumpPipe[1], &c, 1);
+	errno = err;
+}
+
+static void DumpLoop()
+{
+	char c;
+	while(true)
+	{
+		ssize_t n = read_f(s_dumpPipe[0], &c, 1);
+		if(n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(n <= 0)
+		{
+			break;
+		}
+		Fiber::Dump(std::cerr);
+	}
+}
+
+bool Fiber::InstallDumpSignal(int signo)
+{
+	static std::mutex s_mutex;
+	std::lock_guard<std::mutex> lock(s_mutex);
+	if(s_dumpPipe[0] < 0)
+	{
+		// 原始版本：管道由后台线程阻塞读取，不能被hook设为非阻塞
+		if(pipe_f(s_dumpPipe))
+		{
+			return false;
+		}
+		// 随进程存在，不析构
+		new Thread(&DumpLoop, "fiber_dump");
+	}
+
+	struct sigaction sa;
+	sa.sa_handler = &OnDumpSignal;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	return sigaction(signo, &sa, nullptr) == 0;
+}
+
+}
@@ -0,0 +1,500 @@
+#include "fiber_sync.h"
+#include "hook.h"
+#include "ioscheduler.h"
+
+#include <cassert>
+
+namespace sylar {
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+FiberWaiter::FiberWaiter()
+{
+	if(is_hook_enable() && Scheduler::GetThis())
+	{
+		fiber = Fiber::GetThis();
+		scheduler = Scheduler::GetThis();
+	}
+	else
+	{
+		sem.reset(new Semaphore());
+	}
+}
+
+void FiberWaiter::park()
+{
+	if(fiber)
+	{
+		// 唤醒者可能在yield之前就调用了scheduleLock，Scheduler::run会等到yield完成后才resume
+		fiber->yield(Fiber::SUSPENDED_SYNC);
+	}
+	else
+	{
+		sem->wait();
+	}
+}
+
+void FiberWaiter::wake()
+{
+	if(select)
+	{
+		select->waiter.wake();
+	}
+	else if(fiber)
+	{
+		// 等待者恢复运行后会销毁自身 -> 先拷贝出需要的成员
+		RefPtr<Fiber> f = fiber;
+		Scheduler* s = scheduler;
+		s->scheduleLock(f);
+	}
+	else if(callback)
+	{
+		void (*cb)(void*) = callback;
+		void* a = arg;
+		scheduler->scheduleLock([cb, a]() {cb(a);});
+	}
+	else
+	{
+		sem->signal();
+	}
+}
+
+void FiberWaiter::handoff()
+{
+	if(fiber && !select && is_hook_enable() && Scheduler::GetThis() == scheduler)
+	{
+		RefPtr<Fiber> f = fiber;
+		if(Fiber::SetNext(std::move(f)))
+		{
+			return;
+		}
+	}
+	wake();
+}
+
+bool FiberWaiter::claim()
+{
+	if(!select)
+	{
+		return true;
+	}
+	int expected = SelectState::NONE;
+	return select->fired.compare_exchange_strong(expected, index);
+}
+
+// 超时定时器与等待者共享的状态
+// 等待者返回前会在mutex保护下清空waiter，之后定时器回调不会再访问等待者
+struct WaiterTimeout
+{
+	std::mutex mutex;
+	FiberWaiter* waiter = nullptr;
+	std::mutex* guard = nullptr;
+	WaitList* list = nullptr;
+	bool expired = false;
+};
+
+bool FiberWaiter::park(uint64_t timeout_ms, std::mutex& guard, WaitList& list)
+{
+	if(!fiber)
+	{
+		if(sem->waitFor(timeout_ms))
+		{
+			return true;
+		}
+		{
+			std::lock_guard<std::mutex> lock(guard);
+			if(list.remove(this))
+			{
+				return false;
+			}
+		}
+		// 超时的同时被唤醒 -> 消耗掉这次signal
+		sem->wait();
+		return true;
+	}
+
+	IOManager* iom = dynamic_cast<IOManager*>(scheduler);
+	if(!iom)
+	{
+		park();
+		return true;
+	}
+
+	std::shared_ptr<WaiterTimeout> token = std::make_shared<WaiterTimeout>();
+	token->waiter = this;
+	token->guard  = &guard;
+	token->list   = &list;
+	std::shared_ptr<Timer> timer = iom->addTimer(timeout_ms, [token]()
+	{
+		std::lock_guard<std::mutex> lock(token->mutex);
+		if(!token->waiter)
+		{
+			return;
+		}
+		bool removed;
+		{
+			std::lock_guard<std::mutex> g(*token->guard);
+			// 删除失败说明等待者已经被唤醒者取走
+			removed = token->list->remove(token->waiter);
+		}
+		if(removed)
+		{
+			FiberWaiter* w = token->waiter;
+			token->waiter = nullptr;
+			token->expired = true;
+			w->wake();
+		}
+	});
+
+	park();
+
+	timer->cancel();
+	std::lock_guard<std::mutex> lock(token->mutex);
+	token->waiter = nullptr;
+	return !token->expired;
+}
+
+void WaitList::push_back(FiberWaiter* w)
+{
+	w->next = nullptr;
+	w->prev = m_tail;
+	if(m_tail)
+	{
+		m_tail->next = w;
+	}
+	else
+	{
+		m_head = w;
+	}
+	m_tail = w;
+}
+
+FiberWaiter* WaitList::pop_front()
+{
+	FiberWaiter* w = m_head;
+	if(w)
+	{
+		remove(w);
+	}
+	return w;
+}
+
+FiberWaiter* WaitList::pop_claimed()
+{
+	while(FiberWaiter* w = pop_front())
+	{
+		if(w->claim())
+		{
+			return w;
+		}
+	}
+	return nullptr;
+}
+
+bool WaitList::remove(FiberWaiter* w)
+{
+	if(w->prev == nullptr && m_head != w)
+	{
+		return false;
+	}
+
+	if(w->prev)
+	{
+		w->prev->next = w->next;
+	}
+	else
+	{
+		m_head = w->next;
+	}
+	if(w->next)
+	{
+		w->next->prev = w->prev;
+	}
+	else
+	{
+		m_tail = w->prev;
+	}
+	w->prev = w->next = nullptr;
+	return true;
+}
+
+bool FiberMutex::try_lock()
+{
+	return !m_locked.load(std::memory_order_relaxed) && !m_locked.exchange(true, std::memory_order_acquire);
+}
+
+void FiberMutex::lock()
+{
+	for(int i = 0; i < FIBER_SYNC_SPIN; i++)
+	{
+		if(try_lock())
+		{
+			return;
+		}
+		cpu_relax();
+	}
+
+	FiberWaiter w;
+	{
+		std::lock_guard<std::mutex> lock(m_guard);
+		// 先增加计数再重试：unlock()释放锁后若看到计数为0，这里的try_lock()一定能成功
+		m_waiterCount++;
+		if(try_lock())
+		{
+			m_waiterCount--;
+			return;
+		}
+		m_waiters.push_back(&w);
+	}
+	// 被唤醒时锁已经交给了当前协程
+	w.park();
+}
+
+void FiberMutex::unlock()
+{
+	m_locked.store(false, std::memory_order_seq_cst);
+	if(m_waiterCount.load(std::memory_order_seq_cst) == 0)
+	{
+		return;
+	}
+
+	FiberWaiter* w = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_guard);
+		// 重新获取锁并交给队首的等待者；获取失败说明锁被其他协程抢到，由它负责唤醒
+		if(!m_waiters.empty() && try_lock())
+		{
+			w = m_waiters.pop_front();
+			m_waiterCount--;
+		}
+	}
+	if(w)
+	{
+		w->wake();
+	}
+}
+
+void FiberCondVar::wait(FiberMutex& mutex)
+{
+	FiberWaiter w;
+	{
+		std::lock_guard<std::mutex> lock(m_guard);
+		m_waiters.push_back(&w);
+	}
+	// 已经在等待队列中 -> 释放mutex后的notify不会丢失
+	mutex.unlock();
+	w.park();
+	mutex.lock();
+}
+
+void FiberCondVar::notify_one()
+{
+	FiberWaiter* w;
+	{
+		std::lock_guard<std::mutex> lock(m_guard);
+		w = m_waiters.pop_front();
+	}
+	if(w)
+	{
+		w->wake();
+	}
+}
+
+void FiberCondVar::notify_all()
+{
+	WaitList waiters;
+	{
+		std::lock_guard<std::mutex> lock(m_guard);
+		while(!m_waiters.empty())
+		{
+			waiters.push_back(m_waiters.pop_front());
+		}
+	}
+	while(FiberWaiter* w = waiters.pop_front())
+	{
+		w->wake();
+	}
+}
+
+bool FiberSemaphore::try_wait()
+{
+	size_t count = m_count.load(std::memory_order_relaxed);
+	while(count > 0)
+	{
+		if(m_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void FiberSemaphore::wait()
+{
+	for(int i = 0; i < FIBER_SYNC_SPIN; i++)
+	{
+		if(try_wait())
+		{
+			return;
+		}
+		cpu_relax();
+	}
+
+	FiberWaiter w;
+	{
+		std::lock_guard<std::mutex> lock(m_guard);
+		// signal()只在没有等待者时增加计数，且都在m_guard保护下 -> 不会丢失唤醒
+		if(try_wait())
+		{
+			return;
+		}
+		m_waiters.push_back(&w);
+	}
+	w.park();
+}
+
+void FiberSemaphore::signal()
+{
+	FiberWaiter* w;
+	{
+		std::lock_guard<std::mutex> lock(m_guard);
+		w = m_waiters.pop_front();
+		if(!w)
+		{
+			m_count++;
+		}
+	}
+	if(w)
+	{
+		w->wake();
+	}
+}
+
+bool FiberRWLock::try_rdlock()
+{
+	std::lock_guard<std::mutex> lock(m_guard);
+	if(!m_writer && m_waitingWriters == 0)
+	{
+		m_readers++;
+		return true;
+	}
+	return false;
+}
+
+void FiberRWLock::rdlock()
+{
+	for(int i = 0; i < FIBER_SYNC_SPIN; i++)
+	{
+		if(try_rdlock())
+		{
+			return;
+		}
+		cpu_relax();
+	}
+
+	FiberWaiter w;
+	{
+		std::lock_guard<std::mutex> lock(m_guard);
+		if(!m_writer && m_waitingWriters == 0)
+		{
+			m_readers++;
+			return;
+		}
+		w.writer = false;
+		m_waiters.push_back(&w);
+	}
+	w.park();
+}
+
+bool FiberRWLock::try_wrlock()
+{
+	std::lock_guard<std::mutex> lock(m_guard);
+	if(!m_writer && m_readers == 0 && m_waiters.empty())
+	{
+		m_writer = true;
+		return true;
+	}
+	return false;
+}
+
+void FiberRWLock::wrlock()
+{
+	for(int i = 0; i < FIBER_SYNC_SPIN; i++)
+	{
+		if(try_wrlock())
+		{
+			return;
+		}
+		cpu_relax();
+	}
+
+	FiberWaiter w;
+	{
+		std::lock_guard<std::mutex> lock(m_guard);
+		if(!m_writer && m_readers == 0 && m_waiters.empty())
+		{
+			m_writer = true;
+			return;
+		}
+		w.writer = true;
+		m_waitingWriters++;
+		m_waiters.push_back(&w);
+	}
+	w.park();
+}
+
+void FiberRWLock::grant(WaitList& granted)
+{
+	if(!m_writer && !m_waiters.empty())
+	{
+		if(m_waiters.front()->writer)
+		{
+			if(m_readers == 0)
+			{
+				m_writer = true;
+				m_waitingWriters--;
+				granted.push_back(m_waiters.pop_front());
+			}
+		}
+		else
+		{
+			while(!m_waiters.empty() && !m_waiters.front()->writer)
+			{
+				m_readers++;
+				granted.push_back(m_waiters.pop_front());
+			}
+		}
+	}
+}
+
+void FiberRWLock::unlock()
+{
+	WaitList granted;
+	{
+		std::lock_guard<std::mutex> lock(m_guard);
+		if(m_writer)
+		{
+			m_writer = false;
+		}
+		else
+		{
+			assert(m_readers > 0);
+			m_readers--;
+		}
+
+		grant(granted);
+	}
+
+	// 在锁外唤醒，被唤醒的协程已经持有锁
+	while(FiberWaiter* w = granted.pop_front())
+	{
+		w->wake();
+	}
+}
+
+}
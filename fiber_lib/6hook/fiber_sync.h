@@ -0,0 +1,179 @@
+#ifndef _FIBER_SYNC_H_
+#define _FIBER_SYNC_H_
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+
+#include "scheduler.h"
+
+namespace sylar {
+
+// 协程同步原语：等待时挂起协程而不是阻塞线程，唤醒时通过Scheduler::scheduleLock重新调度
+// 不在任务协程中（未启用hook，如主线程）时退化为阻塞线程
+// 等待者和唤醒者可以位于不同的工作线程
+
+class WaitList;
+struct SelectState;
+
+// 等待者：位于等待协程的栈上，在被唤醒之前一直有效
+struct FiberWaiter
+{
+	RefPtr<Fiber> fiber;
+	Scheduler* scheduler = nullptr;
+	// 不在协程中时使用
+	std::unique_ptr<Semaphore> sem;
+	// 侵入式双向链表
+	FiberWaiter* prev = nullptr;
+	FiberWaiter* next = nullptr;
+	// 读写锁：是否为写者
+	bool writer = false;
+	// 由唤醒者设置的结果，含义由具体的同步原语决定（如Channel中表示成功传递了数据）
+	bool ok = false;
+	// 多路等待（Selector）的一个分支：多个等待者共享select，只有第一个claim()成功的分支会唤醒协程
+	SelectState* select = nullptr;
+	int index = -1;
+	// 无栈协程（task.h）：不挂起，唤醒时在scheduler中调用callback(arg)恢复协程
+	void (*callback)(void*) = nullptr;
+	void* arg = nullptr;
+
+	// 记录当前协程，必须在加入等待队列之前调用
+	FiberWaiter();
+	// Selector的分支：不记录协程，由select->waiter挂起和唤醒
+	FiberWaiter(SelectState* state, int idx): select(state), index(idx) {}
+	// 回调等待者，不能park()
+	FiberWaiter(Scheduler* s, void (*cb)(void*), void* a): scheduler(s), callback(cb), arg(a) {}
+
+	// 挂起直到wake()被调用
+	void park();
+	// 带超时的挂起：已经加入list（受guard保护）且已释放guard时调用
+	// 超时则由定时器把等待者从list中删除并返回false；返回true表示被wake()唤醒
+	// 协程中需要IOManager提供定时器，否则退化为不带超时的park()
+	bool park(uint64_t timeout_ms, std::mutex& guard, WaitList& list);
+	// 唤醒等待者，调用后不能再访问该对象
+	void wake();
+	// 唤醒等待者，当前协程下一次挂起时如果它还没有被其他线程取走，就直接切换过去（Fiber::SetNext）
+	// 用于唤醒者随后很可能挂起的场合；双方不在同一调度器的协程中时同wake()
+	void handoff();
+	// 唤醒者在取走等待者时调用（需持有等待队列的锁），失败表示所属的Selector已经由其他分支唤醒
+	bool claim();
+};
+
+// Selector的共享状态
+struct SelectState
+{
+	static const int NONE = -1;
+
+	// 第一个就绪的分支编号
+	std::atomic<int> fired = {NONE};
+	// 实际挂起的协程（或线程）
+	FiberWaiter waiter;
+};
+
+// 侵入式FIFO等待队列，不加锁，由使用者保护
+class WaitList
+{
+public:
+	bool empty() const {return m_head == nullptr;}
+	FiberWaiter* front() const {return m_head;}
+
+	void push_back(FiberWaiter* w);
+	FiberWaiter* pop_front();
+	// 依次取出等待者直到claim()成功，claim失败的（所属Selector已被唤醒）直接丢弃
+	FiberWaiter* pop_claimed();
+	// 删除指定的等待者（超时或取消），不在队列中时返回false
+	bool remove(FiberWaiter* w);
+
+private:
+	FiberWaiter* m_head = nullptr;
+	FiberWaiter* m_tail = nullptr;
+};
+
+// 挂起前的自旋次数：持有者在其他工作线程上很快释放时可以避免一次协程切换
+static const int FIBER_SYNC_SPIN = 64;
+
+class FiberMutex
+{
+public:
+	void lock();
+	bool try_lock();
+	// 有等待者时直接把锁交给队首的等待者
+	void unlock();
+
+private:
+	std::atomic<bool> m_locked = {false};
+	// 等待者数量，unlock()据此判断是否需要进入慢路径
+	std::atomic<size_t> m_waiterCount = {0};
+	// 保护等待队列
+	std::mutex m_guard;
+	WaitList m_waiters;
+};
+
+class FiberCondVar
+{
+public:
+	// 释放mutex并挂起，被唤醒后重新获取mutex
+	void wait(FiberMutex& mutex);
+	void wait(std::unique_lock<FiberMutex>& lock) {wait(*lock.mutex());}
+
+	template<class Predicate>
+	void wait(std::unique_lock<FiberMutex>& lock, Predicate pred)
+	{
+		while(!pred())
+		{
+			wait(lock);
+		}
+	}
+
+	void notify_one();
+	void notify_all();
+
+private:
+	std::mutex m_guard;
+	WaitList m_waiters;
+};
+
+class FiberSemaphore
+{
+public:
+	explicit FiberSemaphore(size_t count = 0): m_count(count) {}
+
+	// P操作
+	void wait();
+	bool try_wait();
+	// V操作：有等待者时直接把许可交给队首的等待者
+	void signal();
+
+private:
+	std::atomic<size_t> m_count;
+	std::mutex m_guard;
+	WaitList m_waiters;
+};
+
+// 读写锁：有写者等待时新的读者也会排队，避免写者饥饿
+class FiberRWLock
+{
+public:
+	void rdlock();
+	bool try_rdlock();
+	void wrlock();
+	bool try_wrlock();
+	void unlock();
+
+private:
+	// 按FIFO顺序授予：队首的写者，或者队首连续的所有读者，被授予者移入granted
+	// 调用时必须持有m_guard
+	void grant(WaitList& granted);
+
+private:
+	std::mutex m_guard;
+	// 持有读锁的读者数
+	size_t m_readers = 0;
+	bool m_writer = false;
+	size_t m_waitingWriters = 0;
+	WaitList m_waiters;
+};
+
+}
+
+#endif
@@ -0,0 +1,63 @@
+#include "future.h"
+
+namespace sylar {
+
+void FutureStateBase::wait()
+{
+	if(isReady())
+	{
+		return;
+	}
+
+	FiberWaiter w;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(isReady())
+		{
+			return;
+		}
+		m_waiters.push_back(&w);
+	}
+	w.park();
+}
+
+void FutureStateBase::complete()
+{
+	WaitList waiters;
+	std::vector<std::function<void()>> callbacks;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		assert(!isReady());
+		m_ready.store(true, std::memory_order_release);
+		while(FiberWaiter* w = m_waiters.pop_front())
+		{
+			waiters.push_back(w);
+		}
+		// 移出回调：回调中可能持有本状态（如when_all），执行后释放以打破循环引用
+		callbacks.swap(m_callbacks);
+	}
+
+	while(FiberWaiter* w = waiters.pop_front())
+	{
+		w->wake();
+	}
+	for(auto& cb : callbacks)
+	{
+		cb();
+	}
+}
+
+void FutureStateBase::then(std::function<void()> cb)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(!isReady())
+		{
+			m_callbacks.push_back(std::move(cb));
+			return;
+		}
+	}
+	cb();
+}
+
+}
@@ -0,0 +1,203 @@
+#ifndef _FUTURE_H_
+#define _FUTURE_H_
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+
+#include "scheduler.h"
+#include "fiber_sync.h"
+#include "cancel.h"
+
+namespace sylar {
+
+// Future的共享状态中与结果类型无关的部分：完成标志、等待者和完成回调
+class FutureStateBase
+{
+public:
+	bool isReady() const {return m_ready.load(std::memory_order_acquire);}
+
+	// 挂起直到完成
+	void wait();
+	// 设置完成：唤醒所有等待者，并在当前上下文中执行完成回调
+	void complete();
+	// 添加完成回调，已经完成时立即执行
+	void then(std::function<void()> cb);
+
+private:
+	std::atomic<bool> m_ready = {false};
+	std::mutex m_mutex;
+	WaitList m_waiters;
+	std::vector<std::function<void()>> m_callbacks;
+};
+
+template<class T>
+struct FutureState : public FutureStateBase
+{
+	OffloadResult<T> result;
+};
+
+// spawn()的结果：get()挂起调用者直到协程完成，返回其结果或重新抛出其异常
+template<class T>
+class Future
+{
+public:
+	Future() {}
+	explicit Future(std::shared_ptr<FutureState<T>> state): m_state(state) {}
+
+	bool valid() const {return m_state != nullptr;}
+	bool isReady() const {return m_state->isReady();}
+	void wait() const {m_state->wait();}
+
+	// 结果被移出，只能调用一次
+	T get()
+	{
+		m_state->wait();
+		return m_state->result.get();
+	}
+
+	const std::shared_ptr<FutureState<T>>& getState() const {return m_state;}
+
+private:
+	std::shared_ptr<FutureState<T>> m_state;
+};
+
+// 在调度器scheduler中创建协程执行fn
+// 新协程继承当前协程的取消令牌（所属TaskGroup的取消、DeadlineScope的截止时间）
+template<class F>
+auto spawn(Scheduler* scheduler, F fn) -> Future<decltype(fn())>
+{
+	using R = decltype(fn());
+	assert(scheduler);
+	std::shared_ptr<FutureState<R>> state = std::make_shared<FutureState<R>>();
+	CancelToken* current = CancelToken::GetThis();
+	std::shared_ptr<CancelToken> token = current ? current->shared_from_this() : nullptr;
+	scheduler->scheduleLock([state, fn, token]() mutable {
+		Fiber* fiber = Fiber::Current();
+		fiber->setCancelToken(token.get());
+		state->result.run(fn);
+		fiber->setCancelToken(nullptr);
+		state->complete();
+	});
+	return Future<R>(state);
+}
+
+// 在当前调度器中创建协程执行fn
+template<class F>
+auto spawn(F fn) -> Future<decltype(fn())>
+{
+	return spawn(Scheduler::GetThis(), std::move(fn));
+}
+
+// 所有futures都完成时完成，结果按原顺序排列；有子任务抛出异常时get()重新抛出下标最小的那个
+// 子任务完成时只递减计数，最后一个完成时才唤醒等待者 -> 等待者只被唤醒一次
+template<class T>
+Future<std::vector<T>> when_all(std::vector<Future<T>> futures)
+{
+	struct Context
+	{
+		std::vector<Future<T>> futures;
+		std::atomic<size_t> remaining;
+		std::shared_ptr<FutureState<std::vector<T>>> state;
+	};
+
+	std::shared_ptr<Context> ctx = std::make_shared<Context>();
+	ctx->futures = std::move(futures);
+	ctx->remaining = ctx->futures.size() + 1;
+	ctx->state = std::make_shared<FutureState<std::vector<T>>>();
+
+	auto done = [ctx]() {
+		if(--ctx->remaining != 0)
+		{
+			return;
+		}
+		auto collect = [&ctx]() {
+			std::vector<T> values;
+			values.reserve(ctx->futures.size());
+			for(auto& f : ctx->futures)
+			{
+				values.push_back(f.get());
+			}
+			return values;
+		};
+		ctx->state->result.run(collect);
+		ctx->futures.clear();
+		ctx->state->complete();
+	};
+	for(auto& f : ctx->futures)
+	{
+		f.getState()->then(done);
+	}
+	// 注册完所有回调后再释放自己的计数，避免在注册过程中完成
+	done();
+	return Future<std::vector<T>>(ctx->state);
+}
+
+inline Future<void> when_all(std::vector<Future<void>> futures)
+{
+	struct Context
+	{
+		std::vector<Future<void>> futures;
+		std::atomic<size_t> remaining;
+		std::shared_ptr<FutureState<void>> state;
+	};
+
+	std::shared_ptr<Context> ctx = std::make_shared<Context>();
+	ctx->futures = std::move(futures);
+	ctx->remaining = ctx->futures.size() + 1;
+	ctx->state = std::make_shared<FutureState<void>>();
+
+	auto done = [ctx]() {
+		if(--ctx->remaining != 0)
+		{
+			return;
+		}
+		auto collect = [&ctx]() {
+			for(auto& f : ctx->futures)
+			{
+				f.get();
+			}
+		};
+		ctx->state->result.run(collect);
+		ctx->futures.clear();
+		ctx->state->complete();
+	};
+	for(auto& f : ctx->futures)
+	{
+		f.getState()->then(done);
+	}
+	done();
+	return Future<void>(ctx->state);
+}
+
+// 任意一个future完成时完成，结果为其下标，之后可以对futures[i]调用get()
+// futures为空时永远不会完成
+template<class T>
+Future<size_t> when_any(const std::vector<Future<T>>& futures)
+{
+	struct Context
+	{
+		std::atomic<bool> fired = {false};
+		std::shared_ptr<FutureState<size_t>> state;
+	};
+
+	std::shared_ptr<Context> ctx = std::make_shared<Context>();
+	ctx->state = std::make_shared<FutureState<size_t>>();
+	for(size_t i = 0; i < futures.size(); i++)
+	{
+		futures[i].getState()->then([ctx, i]() {
+			if(ctx->fired.exchange(true))
+			{
+				return;
+			}
+			ctx->state->result.value.emplace(i);
+			ctx->state->complete();
+		});
+	}
+	return Future<size_t>(ctx->state);
+}
+
+}
+
+#endif
@@ -0,0 +1,118 @@
+#include "generator.h"
+#include "scheduler.h"
+
+namespace sylar {
+
+GeneratorContext::GeneratorContext(std::function<void(GeneratorContext&)> body, StackPool* pool):
+m_body(std::move(body))
+{
+	m_fiber.reset(new Fiber(std::bind(&GeneratorContext::run, this), 0, true, pool));
+}
+
+GeneratorContext::~GeneratorContext()
+{
+	if(m_started && !m_done)
+	{
+		m_stop = true;
+		enter();
+	}
+}
+
+bool GeneratorContext::next()
+{
+	if(m_done)
+	{
+		return false;
+	}
+	m_started = true;
+	enter();
+
+	if(m_error)
+	{
+		std::exception_ptr error = m_error;
+		m_error = nullptr;
+		std::rethrow_exception(error);
+	}
+	return !m_done;
+}
+
+void GeneratorContext::yield(void* value)
+{
+	m_current = value;
+	leave();
+	if(m_stop)
+	{
+		throw Stop();
+	}
+}
+
+void GeneratorContext::enter()
+{
+	RefPtr<Fiber> self = Fiber::GetThis();
+	// 生成器中的hook调用受消费者的TaskGroup取消和DeadlineScope约束
+	m_fiber->setCancelToken(Fiber::GetCancelToken());
+
+	m_consumer = self;
+	m_nested = !self->switchTo(m_fiber, false);
+	if(m_nested)
+	{
+		m_consumer.reset();
+		m_fiber->resume();
+	}
+}
+
+void GeneratorContext::leave()
+{
+	if(m_nested)
+	{
+		m_fiber->yield();
+		return;
+	}
+
+	RefPtr<Fiber> consumer = std::move(m_consumer);
+	if(!m_fiber->switchTo(consumer, false))
+	{
+		Scheduler::GetThis()->scheduleLock(consumer);
+		m_fiber->yield();
+	}
+}
+
+void GeneratorContext::run()
+{
+	try
+	{
+		if(!m_stop)
+		{
+			m_body(*this);
+		}
+	}
+	catch(Stop&)
+	{
+	}
+	catch(...)
+	{
+		m_error = std::current_exception();
+	}
+	m_current = nullptr;
+	m_done = true;
+	m_fiber->setCancelToken(nullptr);
+
+	if(!m_nested)
+	{
+		// 协程结束时的yield()直接切换到消费者
+		RefPtr<Fiber> consumer = std::move(m_consumer);
+		if(!Fiber::SetNext(consumer))
+		{
+			Scheduler::GetThis()->scheduleLock(consumer);
+		}
+	}
+	// 嵌套时结束后回到resume它的消费者
+}
+
+StackPool* GeneratorContext::GetStackPool()
+{
+	static StackPool* s_pool = new StackPool(64 * 1024);
+	return s_pool;
+}
+
+}
@@ -0,0 +1,143 @@
+#ifndef _GENERATOR_H_
+#define _GENERATOR_H_
+
+#include <memory>
+#include <iterator>
+#include <exception>
+#include <functional>
+
+#include "fiber.h"
+
+namespace sylar {
+
+// 生成器的运行状态，与值类型无关
+// 消费者在调度器的任务协程中时，双方通过Fiber::switchTo直接切换：不经过任务队列，生成器中的hook IO正常挂起
+// 否则（普通线程、嵌套的子协程中）生成器作为嵌套子协程运行，其中的阻塞调用直接阻塞线程
+class GeneratorContext
+{
+public:
+	explicit GeneratorContext(std::function<void(GeneratorContext&)> body, StackPool* pool);
+	// 生成器停在yield()中时让yield()抛出异常，展开其栈上的局部变量
+	~GeneratorContext();
+
+	GeneratorContext(const GeneratorContext&) = delete;
+	GeneratorContext& operator=(const GeneratorContext&) = delete;
+
+	// 消费者调用：运行生成器直到下一次yield()或结束，返回是否得到新值；生成器抛出的异常在这里重新抛出
+	bool next();
+	// 生成器调用：把value交给消费者并挂起，直到下一次next()
+	void yield(void* value);
+
+	// 最近一次yield()的值，只在下一次next()之前有效
+	void* current() const {return m_current;}
+	bool done() const {return m_done;}
+
+public:
+	// 生成器默认的协程栈缓存池：64KB，适合栈帧较小的解析器
+	static StackPool* GetStackPool();
+
+private:
+	// 生成器协程的函数
+	void run();
+	// 切换到生成器，直到它yield()或结束
+	void enter();
+	// 切换回消费者
+	void leave();
+
+private:
+	// 析构时让yield()抛出的异常
+	struct Stop {};
+
+	std::function<void(GeneratorContext&)> m_body;
+	RefPtr<Fiber> m_fiber;
+	// 正在等待值的消费者协程，只在直接切换时使用
+	RefPtr<Fiber> m_consumer;
+	void* m_current = nullptr;
+	// 本次next()是否以嵌套子协程的方式运行生成器
+	bool m_nested = false;
+	bool m_started = false;
+	bool m_done = false;
+	bool m_stop = false;
+	std::exception_ptr m_error;
+};
+
+// 基于协程的生成器：把流式解析写成顺序代码，每得到一个值就yield给消费者
+// 值不经过任务队列，消费者与生成器之间只有一次上下文切换
+//
+// sylar::Generator<std::string> lines([fd](sylar::Generator<std::string>::Yielder& y) {
+//     ... read(fd, buf, n) ...
+//     y(line);
+// });
+// for(std::string& line : lines) { ... }
+template<class T>
+class Generator
+{
+public:
+	// 生成器函数的参数，y(value)把值交给消费者
+	class Yielder
+	{
+	public:
+		explicit Yielder(GeneratorContext* ctx): m_ctx(ctx) {}
+
+		void operator()(T value) {m_ctx->yield(&value);}
+		void yield(T value) {m_ctx->yield(&value);}
+
+	private:
+		GeneratorContext* m_ctx;
+	};
+
+	class iterator
+	{
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = T*;
+		using reference = T&;
+
+		explicit iterator(GeneratorContext* ctx = nullptr): m_ctx(ctx) {}
+
+		T& operator*() const {return *(T*)m_ctx->current();}
+		T* operator->() const {return (T*)m_ctx->current();}
+
+		iterator& operator++()
+		{
+			if(!m_ctx->next())
+			{
+				m_ctx = nullptr;
+			}
+			return *this;
+		}
+
+		bool operator==(const iterator& rhs) const {return m_ctx == rhs.m_ctx;}
+		bool operator!=(const iterator& rhs) const {return m_ctx != rhs.m_ctx;}
+
+	private:
+		GeneratorContext* m_ctx;
+	};
+
+	explicit Generator(std::function<void(Yielder&)> fn, StackPool* pool = GeneratorContext::GetStackPool())
+	{
+		m_ctx.reset(new GeneratorContext([fn](GeneratorContext& ctx) {
+			Yielder y(&ctx);
+			fn(y);
+		}, pool));
+	}
+
+	// 运行到下一个值，生成器结束时返回false
+	bool next() {return m_ctx->next();}
+	// 当前值，只在next()返回true之后、下一次next()之前有效
+	T& value() {return *(T*)m_ctx->current();}
+	bool done() const {return m_ctx->done();}
+
+	// 只能遍历一次：begin()取得第一个值
+	iterator begin() {return m_ctx->next() ? iterator(m_ctx.get()) : iterator();}
+	iterator end() {return iterator();}
+
+private:
+	std::unique_ptr<GeneratorContext> m_ctx;
+};
+
+}
+
+#endif
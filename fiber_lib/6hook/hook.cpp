@@ -4,7 +4,16 @@
 #include <iostream>
 #include <cstdarg>
 #include "fd_manager.h"
+#include "dns.h"
+#include "cancel.h"
 #include <string.h>
+#include <arpa/inet.h>
+#include <map>
+#include <chrono>
+#include <climits>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
 
 // apply XX to all functions
 #define HOOK_FUN(XX) \
@@ -14,21 +23,41 @@
     XX(socket) \
     XX(connect) \
     XX(accept) \
+    XX(accept4) \
+    XX(socketpair) \
+    XX(pipe) \
+    XX(pipe2) \
+    XX(eventfd) \
     XX(read) \
     XX(readv) \
     XX(recv) \
     XX(recvfrom) \
     XX(recvmsg) \
+    XX(recvmmsg) \
     XX(write) \
     XX(writev) \
     XX(send) \
     XX(sendto) \
     XX(sendmsg) \
+    XX(sendmmsg) \
+    XX(sendfile) \
+    XX(splice) \
+    XX(tee) \
+    XX(copy_file_range) \
     XX(close) \
+    XX(dup) \
+    XX(dup2) \
+    XX(dup3) \
     XX(fcntl) \
     XX(ioctl) \
     XX(getsockopt) \
-    XX(setsockopt) 
+    XX(setsockopt) \
+    XX(getaddrinfo) \
+    XX(gethostbyname) \
+    XX(poll) \
+    XX(ppoll) \
+    XX(select) \
+    XX(epoll_wait)
 
 namespace sylar{
 
@@ -85,6 +114,48 @@ struct timer_info
     int cancelled = 0;
 };
 
+// 在fd事件上等待期间注册到当前协程的取消令牌：取消时把tinfo标记为令牌的错误码（ECANCELED或ETIMEDOUT）并cancelEvent唤醒协程
+// 注册时已经被取消则立即cancelEvent（此时事件已经注册，协程yield后马上被重新调度）
+class CancelWait
+{
+public:
+    CancelWait(sylar::IOManager* iom, int fd, sylar::IOManager::Event event, timer_info* tinfo):
+    m_iom(iom), m_fd(fd), m_event(event), m_tinfo(tinfo), m_hook(&CancelWait::OnCancel, this)
+    {
+        if(!m_hook.entered() && sylar::CancelToken::IsCancelled())
+        {
+            m_tinfo->cancelled = sylar::CancelToken::GetError();
+            m_iom->cancelEvent(m_fd, m_event);
+        }
+    }
+
+private:
+    static void OnCancel(void* arg)
+    {
+        CancelWait* self = (CancelWait*)arg;
+        if(!self->m_tinfo->cancelled)
+        {
+            self->m_tinfo->cancelled = self->m_hook.token()->getError();
+        }
+        self->m_iom->cancelEvent(self->m_fd, self->m_event);
+    }
+
+private:
+    sylar::IOManager* m_iom;
+    int m_fd;
+    sylar::IOManager::Event m_event;
+    timer_info* m_tinfo;
+    // 必须最后初始化：注册后其他线程随时可能调用OnCancel
+    sylar::CancelScopeHook m_hook;
+};
+
+// CancelHook的回调：arg指向类型为F的可调用对象
+template<class F>
+static void call_function(void* arg)
+{
+    (*(F*)arg)();
+}
+
 
 // Hook 机制的核心逻辑封装​​，它通过模板化设计统一处理所有读/写类系统调用（如 read, write, recv, send 等），
 // 实现了 ​​非阻塞操作、超时管理和协程调度​​ 的透明化
@@ -109,8 +180,8 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name, uint32_t
         return -1;
     }
 
-    // 非 Socket 或用户显式设置非阻塞​​：直接调用原始函数，不进行协程调度
-    if(!ctx->isSocket() || ctx->getUserNonblock()) 
+    // 不能被epoll监听（普通文件等）或用户显式设置非阻塞​​：直接调用原始函数，不进行协程调度
+    if(!ctx->isPollable() || ctx->getUserNonblock()) 
     {
         return fun(fd, std::forward<Args>(args)...);
     }
@@ -131,6 +202,9 @@ retry:
         n = fun(fd, std::forward<Args>(args)...);
     }
     
+    // 按系统调用统计调用次数和需要挂起等待的比例
+    sylar::Metrics::Hook(hook_fun_name, n == -1 && errno == EAGAIN);
+
     // 0 resource was temporarily unavailable -> retry until ready 
     if(n == -1 && errno == EAGAIN)  //EAGAIN：资源暂时不可用（数据未就绪），挂起协程并等待事件
     {
@@ -140,7 +214,8 @@ retry:
         std::weak_ptr<timer_info> winfo(tinfo);
 
         // 1 timeout has been set -> add a conditional timer for canceling this operation
-        if(timeout != (uint64_t)-1) 
+        // 协程的截止时间（DeadlineScope）更早时由它的定时器负责唤醒，不再为这次调用添加定时器
+        if(timeout != (uint64_t)-1 && !sylar::CancelToken::DeadlineWithin(timeout)) 
         {
             //获取当前的 I/O 管理器 iom，并设置一个条件定时器 timer，用于在超时后取消事件
             timer = iom->addConditionTimer(timeout, [winfo, fd, iom, event]() 
@@ -156,6 +231,17 @@ retry:
             }, winfo);
         }
 
+        // 所属的TaskGroup已被取消或到达截止时间 -> 不再等待
+        if(sylar::CancelToken::IsCancelled())
+        {
+            if(timer)
+            {
+                timer->cancel();
+            }
+            errno = sylar::CancelToken::GetError();
+            return -1;
+        }
+
         // 将 FD 的读/写事件注册到 epoll
         // 2 add event -> callback is this fiber
         int rt = iom->addEvent(fd, (sylar::IOManager::Event)(event));
@@ -170,7 +256,11 @@ retry:
         } 
         else 
         {
-            sylar::Fiber::GetThis()->yield();  // 当前协程主动让出 CPU，等待事件就绪或超时触发
+            {
+                // 等待期间被取消或到达截止时间 -> 与超时一样通过cancelEvent唤醒
+                CancelWait cancel_wait(iom, fd, (sylar::IOManager::Event)(event), tinfo.get());
+                sylar::Fiber::Current()->yield(sylar::Fiber::SUSPENDED_IO);  // 当前协程主动让出 CPU，等待事件就绪或超时触发
+            }
      
             // 3 resume either by addEvent or cancelEvent
             if(timer)  // 若事件提前就绪，取消未触发的定时器
@@ -178,7 +268,7 @@ retry:
                 timer->cancel();
             }
             // by cancelEvent
-            if(tinfo->cancelled == ETIMEDOUT)  // 若因超时被唤醒，返回 ETIMEDOUT 错误
+            if(tinfo->cancelled)  // 若因超时、取消或截止时间到期被唤醒，返回对应的错误
             {
                 errno = tinfo->cancelled;
                 return -1;
@@ -186,10 +276,367 @@ retry:
             goto retry;
         }
     }
+    // 没有挂起就完成 -> 消耗协作式预算，耗尽时让出给同一线程上的其他协程
+    sylar::Fiber::ConsumeBudget();
+    return n;
+}
+
+
+// poll/select/epoll_wait的公共逻辑：把所有关心的fd注册到IOManager，任意一个就绪或超时后唤醒当前协程，
+// 醒来后用原始poll重新计算revents
+// timeout: 毫秒，负数表示无限等待
+static int do_poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    int n = poll_f(fds, nfds, 0);
+    if(n != 0 || timeout == 0)
+    {
+        return n;
+    }
+
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    if(!iom)
+    {
+        return poll_f(fds, nfds, timeout);
+    }
+
+    // 同一个fd可能出现多次 -> 合并事件，每个fd的每种事件只能注册一次
+    std::map<int, int> interest;
+    for(nfds_t i = 0; i < nfds; i++)
+    {
+        if(fds[i].fd < 0)
+        {
+            continue;
+        }
+        int event = sylar::IOManager::NONE;
+        if(fds[i].events & (POLLIN | POLLPRI | POLLRDNORM | POLLRDBAND))
+        {
+            event |= sylar::IOManager::READ;
+        }
+        if(fds[i].events & (POLLOUT | POLLWRNORM | POLLWRBAND))
+        {
+            event |= sylar::IOManager::WRITE;
+        }
+        // 只关心POLLHUP/POLLERR（events为0）-> 注册读事件，epoll总会同时报告EPOLLHUP/EPOLLERR，否则没有任何事件能唤醒
+        if(event == sylar::IOManager::NONE)
+        {
+            event = sylar::IOManager::READ;
+        }
+        interest[fds[i].fd] |= event;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    while(true)
+    {
+        int remaining = timeout;
+        if(timeout > 0)
+        {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            remaining = std::max((int)left.count(), 0);
+        }
+
+        if(sylar::CancelToken::IsCancelled())
+        {
+            errno = sylar::CancelToken::GetError();
+            return -1;
+        }
+
+        // 多个事件和定时器共用一个唤醒回调，只有第一个触发的回调会重新调度协程
+        sylar::RefPtr<sylar::Fiber> fiber = sylar::Fiber::GetThis();
+        std::shared_ptr<std::atomic<bool>> woken = std::make_shared<std::atomic<bool>>(false);
+        // 按值复制进每个事件和定时器的Callback，不需要分配内存
+        auto wake = [woken, fiber, iom]()
+        {
+            if(!woken->exchange(true))
+            {
+                iom->scheduleLock(fiber);
+            }
+        };
+
+        std::vector<std::pair<int, sylar::IOManager::Event>> added;
+        bool failed = false;
+        for(auto& i : interest)
+        {
+            for(auto event : {sylar::IOManager::READ, sylar::IOManager::WRITE})
+            {
+                if(!(i.second & event))
+                {
+                    continue;
+                }
+                // 已被其他协程注册或者fd不支持epoll（如普通文件）
+                if(iom->addEvent(i.first, event, wake))
+                {
+                    failed = true;
+                    break;
+                }
+                added.push_back({i.first, event});
+            }
+            if(failed)
+            {
+                break;
+            }
+        }
+
+        // 无法注册 -> 退化为阻塞当前线程的原始版本
+        if(failed)
+        {
+            for(auto& i : added)
+            {
+                iom->delEvent(i.first, i.second);
+            }
+            return poll_f(fds, nfds, remaining);
+        }
+
+        std::shared_ptr<sylar::Timer> timer;
+        if(timeout > 0)
+        {
+            timer = iom->addTimer(remaining, wake);
+        }
+
+        {
+            // 被取消或到达截止时间时同样通过wake唤醒
+            sylar::CancelScopeHook cancel_hook(&call_function<decltype(wake)>, &wake);
+            if(!cancel_hook.entered() && sylar::CancelToken::IsCancelled())
+            {
+                wake();
+            }
+            fiber->yield(sylar::Fiber::SUSPENDED_IO);
+        }
+
+        // 删除尚未触发的事件和定时器
+        if(timer)
+        {
+            timer->cancel();
+        }
+        for(auto& i : added)
+        {
+            iom->delEvent(i.first, i.second);
+        }
+
+        if(sylar::CancelToken::IsCancelled())
+        {
+            errno = sylar::CancelToken::GetError();
+            return -1;
+        }
+
+        n = poll_f(fds, nfds, 0);
+        if(n != 0 || (timeout > 0 && std::chrono::steady_clock::now() >= deadline))
+        {
+            return n;
+        }
+    }
+}
+
+// 两端都可能被epoll监听的调用（sendfile/splice/tee/copy_file_range）：EAGAIN时只等待尚未就绪的一端
+template<typename OriginFun, typename... Args>
+static ssize_t do_io_pair(int fd_in, int fd_out, OriginFun fun, const char* hook_fun_name, Args&&... args)
+{
+    if(!sylar::t_hook_enable) 
+    {
+        return fun(std::forward<Args>(args)...);
+    }
+
+    std::shared_ptr<sylar::FdCtx> in_ctx  = sylar::FdMgr::GetInstance()->get(fd_in);
+    std::shared_ptr<sylar::FdCtx> out_ctx = sylar::FdMgr::GetInstance()->get(fd_out);
+    if((in_ctx && in_ctx->isClosed()) || (out_ctx && out_ctx->isClosed())) 
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    // 只有受协程库管理、且用户没有设置非阻塞的一端需要等待
+    bool wait_in  = in_ctx && in_ctx->isPollable() && !in_ctx->getUserNonblock();
+    bool wait_out = out_ctx && out_ctx->isPollable() && !out_ctx->getUserNonblock();
+    if(!wait_in && !wait_out) 
+    {
+        return fun(std::forward<Args>(args)...);
+    }
+
+    uint64_t timeout = std::min(wait_in ? in_ctx->getTimeout(SO_RCVTIMEO) : (uint64_t)-1,
+                                wait_out ? out_ctx->getTimeout(SO_SNDTIMEO) : (uint64_t)-1);
+
+    while(true)
+    {
+        ssize_t n = fun(std::forward<Args>(args)...);
+        while(n == -1 && errno == EINTR) 
+        {
+            n = fun(std::forward<Args>(args)...);
+        }
+        sylar::Metrics::Hook(hook_fun_name, n == -1 && errno == EAGAIN);
+        if(n != -1 || errno != EAGAIN) 
+        {
+            sylar::Fiber::ConsumeBudget();
+            return n;
+        }
+
+        struct pollfd pfds[2];
+        nfds_t nfds = 0;
+        if(wait_in)
+        {
+            pfds[nfds++] = {fd_in, POLLIN, 0};
+        }
+        if(wait_out)
+        {
+            pfds[nfds++] = {fd_out, POLLOUT, 0};
+        }
+
+        // 已经就绪的一端会立刻唤醒协程 -> 只等待未就绪的一端
+        poll_f(pfds, nfds, 0);
+        struct pollfd waits[2];
+        nfds_t nwaits = 0;
+        for(nfds_t i = 0; i < nfds; i++)
+        {
+            if(!pfds[i].revents)
+            {
+                waits[nwaits++] = pfds[i];
+            }
+        }
+        if(nwaits == 0)
+        {
+            // 两端都受管理 -> 就绪发生在调用之后，重试；否则是不受管理的一端返回的EAGAIN
+            if(wait_in && wait_out)
+            {
+                continue;
+            }
+            errno = EAGAIN;
+            return -1;
+        }
+
+        int rt = do_poll(waits, nwaits, timeout == (uint64_t)-1 ? -1 : (int)std::min<uint64_t>(timeout, INT_MAX));
+        if(rt == 0)
+        {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        // 取消、超时等失败 -> errno由do_poll设置
+        if(rt < 0)
+        {
+            return -1;
+        }
+    }
+}
+
+// 不受管理的管道：splice/tee不能加SPLICE_F_NONBLOCK，否则会把EAGAIN直接返回给用户
+static bool is_unmanaged_pipe(int fd)
+{
+    if(sylar::FdMgr::GetInstance()->get(fd))
+    {
+        return false;
+    }
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+// MSG_ZEROCOPY：发送成功后等待错误队列中的完成通知，返回时缓冲区可以被重用
+// 同一个socket上只应有一个协程进行zerocopy发送，否则序号与通知无法对应
+// sends：本次调用成功发送的次数（sendmmsg为发送的消息数），n：返回给用户的值
+static ssize_t wait_zerocopy(int fd, ssize_t n, uint32_t sends)
+{
+    if(n < 0 || sends == 0)
+    {
+        return n;
+    }
+
+    std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(fd);
+    if(!ctx || !ctx->isZeroCopy())
+    {
+        return n;
+    }
+
+    // 内核对socket上每次成功的zerocopy发送计数，包括未启用hook的线程（卸载线程等）和用户非阻塞的调用
+    // -> 不等待的发送也要分配序号，否则之后的序号落后于内核的通知，缓冲区会在完成之前被判定为可以重用
+    uint32_t id = ctx->nextZeroCopyId(sends) + sends - 1;
+    if(!sylar::t_hook_enable || ctx->getUserNonblock())
+    {
+        return n;
+    }
+
+    uint64_t timeout = ctx->getTimeout(SO_SNDTIMEO);
+    int errno_saved = errno;
+    while(!ctx->isZeroCopyDone(id))
+    {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+
+        int rt = recvmsg_f(fd, &msg, MSG_ERRQUEUE);
+        if(rt == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            if(errno != EAGAIN)
+            {
+                break;
+            }
+
+            // 错误队列为空 -> 挂起直到socket出现EPOLLERR
+            // 超时或连接已断开时不再等待：数据已经交给内核，返回已发送的字节数
+            epoll_event event;
+            rt = epoll_wait(ctx->getZeroCopyEpfd(), &event, 1, timeout == (uint64_t)-1 ? -1 : (int)std::min<uint64_t>(timeout, INT_MAX));
+            if(rt <= 0 || (event.events & EPOLLHUP))
+            {
+                break;
+            }
+            continue;
+        }
+
+        for(struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            if(!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) 
+                && !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+            {
+                continue;
+            }
+            struct sock_extended_err* serr = (struct sock_extended_err*)CMSG_DATA(cm);
+            if(serr->ee_errno == 0 && serr->ee_origin == SO_EE_ORIGIN_ZEROCOPY)
+            {
+                // [ee_info, ee_data]范围内的发送已完成
+                ctx->completeZeroCopy(serr->ee_info, serr->ee_data);
+            }
+        }
+    }
+    errno = errno_saved;
     return n;
 }
 
 
+// sleep系列的公共逻辑：添加定时器重新调度当前协程
+// 所属的TaskGroup被取消或到达截止时间（DeadlineScope）时提前唤醒并返回false
+static bool do_sleep(uint64_t ms)
+{
+	if(sylar::CancelToken::IsCancelled())
+	{
+		return false;
+	}
+
+	sylar::RefPtr<sylar::Fiber> fiber = sylar::Fiber::GetThis();
+	sylar::IOManager* iom = sylar::IOManager::GetThis();
+	// 定时器和取消共用一个唤醒回调，只有第一个会重新调度协程
+	std::shared_ptr<std::atomic<bool>> woken = std::make_shared<std::atomic<bool>>(false);
+	auto wake = [woken, fiber, iom]()
+	{
+		if(!woken->exchange(true))
+		{
+			iom->scheduleLock(fiber);
+		}
+	};
+	// add a timer to reschedule this fiber
+	std::shared_ptr<sylar::Timer> timer = iom->addTimer(ms, wake);
+	{
+		sylar::CancelScopeHook cancel_hook(&call_function<decltype(wake)>, &wake);
+		if(!cancel_hook.entered() && sylar::CancelToken::IsCancelled())
+		{
+			wake();
+		}
+		// wait for the next resume
+		fiber->yield(sylar::Fiber::SUSPENDED_TIMER);
+	}
+	timer->cancel();
+	return !sylar::CancelToken::IsCancelled();
+}
 
 extern "C"{
 
@@ -206,13 +653,8 @@ unsigned int sleep(unsigned int seconds)
 		return sleep_f(seconds);
 	}
 
-	std::shared_ptr<sylar::Fiber> fiber = sylar::Fiber::GetThis();
-	sylar::IOManager* iom = sylar::IOManager::GetThis();
-	// add a timer to reschedule this fiber
-	iom->addTimer(seconds*1000, [fiber, iom](){iom->scheduleLock(fiber, -1);});
-	// wait for the next resume
-	fiber->yield();
-	return 0;
+	// 被取消或到达截止时间时返回未睡眠的秒数（近似为全部）
+	return do_sleep(seconds*1000) ? 0 : seconds;
 }
 
 int usleep(useconds_t usec)
@@ -222,12 +664,11 @@ int usleep(useconds_t usec)
 		return usleep_f(usec);
 	}
 
-	std::shared_ptr<sylar::Fiber> fiber = sylar::Fiber::GetThis();
-	sylar::IOManager* iom = sylar::IOManager::GetThis();
-	// add a timer to reschedule this fiber
-	iom->addTimer(usec/1000, [fiber, iom](){iom->scheduleLock(fiber);});
-	// wait for the next resume
-	fiber->yield();
+	if(!do_sleep(usec/1000))
+	{
+		errno = sylar::CancelToken::GetError();
+		return -1;
+	}
 	return 0;
 }
 
@@ -241,12 +682,11 @@ int nanosleep(const struct timespec* req, struct timespec* rem)
 
 	int timeout_ms = req->tv_sec*1000 + req->tv_nsec/1000/1000;
 
-	std::shared_ptr<sylar::Fiber> fiber = sylar::Fiber::GetThis();
-	sylar::IOManager* iom = sylar::IOManager::GetThis();
-	// add a timer to reschedule this fiber
-	iom->addTimer(timeout_ms, [fiber, iom](){iom->scheduleLock(fiber, -1);});
-	// wait for the next resume
-	fiber->yield();	
+	if(!do_sleep(timeout_ms))
+	{
+		errno = sylar::CancelToken::GetError();
+		return -1;
+	}
 	return 0;
 }
 
@@ -257,13 +697,15 @@ int socket(int domain, int type, int protocol)
 		return socket_f(domain, type, protocol);
 	}	
 
-	int fd = socket_f(domain, type, protocol);
+	// 创建时即设为非阻塞，FdCtx无需再调用fstat和fcntl
+	int fd = socket_f(domain, type | SOCK_NONBLOCK, protocol);
 	if(fd==-1)
 	{
 		std::cerr << "socket() failed:" << strerror(errno) << std::endl;
 		return fd;
 	}
-	sylar::FdMgr::GetInstance()->get(fd, true);  // 加入文件描述符管理器
+	// 加入文件描述符管理器
+	sylar::FdMgr::GetInstance()->add(fd, sylar::FdCtx::SOCKET)->setUserNonblock(type & SOCK_NONBLOCK);
 	return fd;
 }
 
@@ -308,7 +750,7 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     std::shared_ptr<timer_info> tinfo(new timer_info);
     std::weak_ptr<timer_info> winfo(tinfo);
 
-    if(timeout_ms != (uint64_t)-1) 
+    if(timeout_ms != (uint64_t)-1 && !sylar::CancelToken::DeadlineWithin(timeout_ms)) 
     {
         timer = iom->addConditionTimer(timeout_ms, [winfo, fd, iom]() 
         {
@@ -322,10 +764,23 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
         }, winfo);
     }
 
+    if(sylar::CancelToken::IsCancelled())
+    {
+        if(timer) 
+        {
+            timer->cancel();
+        }
+        errno = sylar::CancelToken::GetError();
+        return -1;
+    }
+
     int rt = iom->addEvent(fd, sylar::IOManager::WRITE);
     if(rt == 0) // 表示添加操作成功或至少没有立即失败
     {
-        sylar::Fiber::GetThis()->yield();
+        {
+            CancelWait cancel_wait(iom, fd, sylar::IOManager::WRITE, tinfo.get());
+            sylar::Fiber::Current()->yield(sylar::Fiber::SUSPENDED_IO);
+        }
 
         // resume either by addEvent or cancelEvent
         if(timer) 
@@ -375,10 +830,75 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen)
 
 int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
 {
-	int fd = do_io(sockfd, accept_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen);	
+	return accept4(sockfd, addr, addrlen, 0);
+}
+
+int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags)
+{
+	if(!sylar::t_hook_enable)
+	{
+		return accept4_f(sockfd, addr, addrlen, flags);
+	}
+
+	// 新连接直接以非阻塞方式创建，省去FdCtx::init()中的fstat和两次fcntl
+	int fd = do_io(sockfd, accept4_f, "accept4", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen, flags | SOCK_NONBLOCK);	
 	if(fd>=0)
 	{
-		sylar::FdMgr::GetInstance()->get(fd, true);
+		sylar::FdMgr::GetInstance()->add(fd, sylar::FdCtx::SOCKET)->setUserNonblock(flags & SOCK_NONBLOCK);
+	}
+	return fd;
+}
+
+int socketpair(int domain, int type, int protocol, int sv[2])
+{
+	if(!sylar::t_hook_enable)
+	{
+		return socketpair_f(domain, type, protocol, sv);
+	}
+
+	int rt = socketpair_f(domain, type | SOCK_NONBLOCK, protocol, sv);
+	if(rt==0)
+	{
+		sylar::FdMgr::GetInstance()->add(sv[0], sylar::FdCtx::SOCKET)->setUserNonblock(type & SOCK_NONBLOCK);
+		sylar::FdMgr::GetInstance()->add(sv[1], sylar::FdCtx::SOCKET)->setUserNonblock(type & SOCK_NONBLOCK);
+	}
+	return rt;
+}
+
+int pipe(int pipefd[2])
+{
+	return pipe2(pipefd, 0);
+}
+
+// 注意：O_NONBLOCK属于打开文件而不是fd，通过fork继承管道的子进程看到的也是非阻塞的管道
+int pipe2(int pipefd[2], int flags)
+{
+	if(!sylar::t_hook_enable)
+	{
+		return pipe2_f(pipefd, flags);
+	}
+
+	int rt = pipe2_f(pipefd, flags | O_NONBLOCK);
+	if(rt==0)
+	{
+		sylar::FdMgr::GetInstance()->add(pipefd[0], sylar::FdCtx::PIPE)->setUserNonblock(flags & O_NONBLOCK);
+		sylar::FdMgr::GetInstance()->add(pipefd[1], sylar::FdCtx::PIPE)->setUserNonblock(flags & O_NONBLOCK);
+	}
+	return rt;
+}
+
+int eventfd(unsigned int initval, int flags)
+{
+	if(!sylar::t_hook_enable)
+	{
+		return eventfd_f(initval, flags);
+	}
+
+	// eventfd_read/eventfd_write基于read/write -> 计数为0时挂起协程
+	int fd = eventfd_f(initval, flags | EFD_NONBLOCK);
+	if(fd>=0)
+	{
+		sylar::FdMgr::GetInstance()->add(fd, sylar::FdCtx::PIPE)->setUserNonblock(flags & EFD_NONBLOCK);
 	}
 	return fd;
 }
@@ -408,6 +928,12 @@ ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags)
 	return do_io(sockfd, recvmsg_f, "recvmsg", sylar::IOManager::READ, SO_RCVTIMEO, msg, flags);	
 }
 
+// 一次系统调用接收多个数据报，返回接收到的个数
+int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout)
+{
+	return do_io(sockfd, recvmmsg_f, "recvmmsg", sylar::IOManager::READ, SO_RCVTIMEO, msgvec, vlen, flags, timeout);	
+}
+
 ssize_t write(int fd, const void *buf, size_t count)
 {
 	return do_io(fd, write_f, "write", sylar::IOManager::WRITE, SO_SNDTIMEO, buf, count);	
@@ -420,17 +946,82 @@ ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
 
 ssize_t send(int sockfd, const void *buf, size_t len, int flags)
 {
-	return do_io(sockfd, send_f, "send", sylar::IOManager::WRITE, SO_SNDTIMEO, buf, len, flags);	
+	ssize_t n = do_io(sockfd, send_f, "send", sylar::IOManager::WRITE, SO_SNDTIMEO, buf, len, flags);	
+	if(flags & MSG_ZEROCOPY)
+	{
+		n = wait_zerocopy(sockfd, n, 1);
+	}
+	return n;
 }
 
 ssize_t sendto(int sockfd, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, socklen_t addrlen)
 {
-	return do_io(sockfd, sendto_f, "sendto", sylar::IOManager::WRITE, SO_SNDTIMEO, buf, len, flags, dest_addr, addrlen);	
+	ssize_t n = do_io(sockfd, sendto_f, "sendto", sylar::IOManager::WRITE, SO_SNDTIMEO, buf, len, flags, dest_addr, addrlen);	
+	if(flags & MSG_ZEROCOPY)
+	{
+		n = wait_zerocopy(sockfd, n, 1);
+	}
+	return n;
 }
 
 ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags)
 {
-	return do_io(sockfd, sendmsg_f, "sendmsg", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, flags);	
+	ssize_t n = do_io(sockfd, sendmsg_f, "sendmsg", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, flags);	
+	if(flags & MSG_ZEROCOPY)
+	{
+		n = wait_zerocopy(sockfd, n, 1);
+	}
+	return n;
+}
+
+// 一次系统调用发送多个数据报，返回发送成功的个数
+int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags)
+{
+	int n = do_io(sockfd, sendmmsg_f, "sendmmsg", sylar::IOManager::WRITE, SO_SNDTIMEO, msgvec, vlen, flags);	
+	if(flags & MSG_ZEROCOPY)
+	{
+		// 每条发送的消息各占一个序号
+		n = (int)wait_zerocopy(sockfd, n, n > 0 ? n : 0);
+	}
+	return n;
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+	return do_io_pair(in_fd, out_fd, sendfile_f, "sendfile", out_fd, in_fd, offset, count);
+}
+
+ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags)
+{
+	// 用户要求非阻塞 -> 直接透传
+	if(!sylar::t_hook_enable || (flags & SPLICE_F_NONBLOCK))
+	{
+		return splice_f(fd_in, off_in, fd_out, off_out, len, flags);
+	}
+	// 管道端的非阻塞由SPLICE_F_NONBLOCK控制
+	if(!is_unmanaged_pipe(fd_in) && !is_unmanaged_pipe(fd_out))
+	{
+		flags |= SPLICE_F_NONBLOCK;
+	}
+	return do_io_pair(fd_in, fd_out, splice_f, "splice", fd_in, off_in, fd_out, off_out, len, flags);
+}
+
+ssize_t tee(int fd_in, int fd_out, size_t len, unsigned int flags)
+{
+	if(!sylar::t_hook_enable || (flags & SPLICE_F_NONBLOCK))
+	{
+		return tee_f(fd_in, fd_out, len, flags);
+	}
+	if(!is_unmanaged_pipe(fd_in) && !is_unmanaged_pipe(fd_out))
+	{
+		flags |= SPLICE_F_NONBLOCK;
+	}
+	return do_io_pair(fd_in, fd_out, tee_f, "tee", fd_in, fd_out, len, flags);
+}
+
+ssize_t copy_file_range(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags)
+{
+	return do_io_pair(fd_in, fd_out, copy_file_range_f, "copy_file_range", fd_in, off_in, fd_out, off_out, len, flags);
 }
 
 int close(int fd)
@@ -455,6 +1046,69 @@ int close(int fd)
 	return close_f(fd);
 }
 
+int dup(int oldfd)
+{
+	int fd = dup_f(oldfd);
+	if(sylar::t_hook_enable && fd>=0)
+	{
+		sylar::FdMgr::GetInstance()->dup(oldfd, fd);
+	}
+	return fd;
+}
+
+// dup2/dup3会先静默关闭newfd -> 与close()一样取消newfd上的事件
+static void close_for_dup(int oldfd, int newfd)
+{
+	// oldfd无效时dup2失败，不会关闭newfd
+	if(oldfd==newfd || fcntl_f(oldfd, F_GETFD)==-1)
+	{
+		return;
+	}
+
+	std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(newfd);
+	if(ctx)
+	{
+		auto iom = sylar::IOManager::GetThis();
+		if(iom)
+		{
+			iom->cancelAll(newfd);
+		}
+		sylar::FdMgr::GetInstance()->del(newfd);
+	}
+}
+
+int dup2(int oldfd, int newfd)
+{
+	if(!sylar::t_hook_enable)
+	{
+		return dup2_f(oldfd, newfd);
+	}
+
+	close_for_dup(oldfd, newfd);
+	int fd = dup2_f(oldfd, newfd);
+	if(fd>=0 && oldfd!=newfd)
+	{
+		sylar::FdMgr::GetInstance()->dup(oldfd, fd);
+	}
+	return fd;
+}
+
+int dup3(int oldfd, int newfd, int flags)
+{
+	if(!sylar::t_hook_enable)
+	{
+		return dup3_f(oldfd, newfd, flags);
+	}
+
+	close_for_dup(oldfd, newfd);
+	int fd = dup3_f(oldfd, newfd, flags);
+	if(fd>=0)
+	{
+		sylar::FdMgr::GetInstance()->dup(oldfd, fd);
+	}
+	return fd;
+}
+
 int fcntl(int fd, int cmd, ... /* arg */ )
 {
   	va_list va; // 定义 va_list 变量
@@ -467,9 +1121,9 @@ int fcntl(int fd, int cmd, ... /* arg */ )
                 int arg = va_arg(va, int); // 提取下一个参数（类型为 int）
                 va_end(va);                         // 结束对可变参数的访问
                 std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(fd);   //获取文件描述符对应的上下文FdCtx
-                if(!ctx || ctx->isClosed() || !ctx->isSocket())   
+                if(!ctx || ctx->isClosed() || !ctx->isPollable())   
                 {
-                    return fcntl_f(fd, cmd, arg);  // 非 Socket 直接透传
+                    return fcntl_f(fd, cmd, arg);  // 不受协程库控制的 fd 直接透传
                 }
                 // 用户是否设定了非阻塞
                 ctx->setUserNonblock(arg & O_NONBLOCK);
@@ -494,7 +1148,7 @@ int fcntl(int fd, int cmd, ... /* arg */ )
                 va_end(va);
                 int arg = fcntl_f(fd, cmd);
                 std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(fd);
-                if(!ctx || ctx->isClosed() || !ctx->isSocket()) 
+                if(!ctx || ctx->isClosed() || !ctx->isPollable()) 
                 {
                     return arg;
                 }
@@ -510,9 +1164,22 @@ int fcntl(int fd, int cmd, ... /* arg */ )
             }
             break;
 
-        // 文件描述符复制、关闭标志设置等命令无需协程库干预，直接调用原始函数
+        // 复制出的fd继承源fd的上下文
         case F_DUPFD:
         case F_DUPFD_CLOEXEC:
+            {
+                int arg = va_arg(va, int);
+                va_end(va);
+                int newfd = fcntl_f(fd, cmd, arg);
+                if(sylar::t_hook_enable && newfd>=0)
+                {
+                    sylar::FdMgr::GetInstance()->dup(fd, newfd);
+                }
+                return newfd;
+            }
+            break;
+
+        // 关闭标志设置等命令无需协程库干预，直接调用原始函数
         case F_SETFD:
         case F_SETOWN:
         case F_SETSIG:
@@ -582,7 +1249,7 @@ int ioctl(int fd, unsigned long request, ...)
     {
         bool user_nonblock = !!*(int*)arg;  //!! 操作符用于将值转换为布尔类型（true 或 false），表示是否启用非阻塞模式
         std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(fd);
-        if(!ctx || ctx->isClosed() || !ctx->isSocket()) 
+        if(!ctx || ctx->isClosed() || !ctx->isPollable()) 
         {
             return ioctl_f(fd, request, arg);
         }
@@ -614,8 +1281,319 @@ int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t
                 ctx->setTimeout(optname, v->tv_sec * 1000 + v->tv_usec / 1000);
             }
         }
+        else if(optname == SO_ZEROCOPY)  // 开启zerocopy -> 创建等待完成通知的epoll实例
+        {
+            int rt = setsockopt_f(sockfd, level, optname, optval, optlen);
+            std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(sockfd);
+            if(rt == 0 && ctx && ctx->isSocket()) 
+            {
+                ctx->setZeroCopy(*(const int*)optval != 0);
+            }
+            return rt;
+        }
     }
     return setsockopt_f(sockfd, level, optname, optval, optlen);	
 }
 
+// 地址是否为数字形式 -> 原始版本不会访问网络，无需协程化
+static bool is_numeric_host(const char* node)
+{
+    unsigned char buf[sizeof(struct in6_addr)];
+    return inet_pton(AF_INET, node, buf) == 1 || inet_pton(AF_INET6, node, buf) == 1;
 }
+
+int getaddrinfo(const char *node, const char *service, const struct addrinfo *hints, struct addrinfo **res)
+{
+    if(!sylar::t_hook_enable || !node || is_numeric_host(node)) 
+    {
+        return getaddrinfo_f(node, service, hints, res);
+    }
+
+    int family = hints ? hints->ai_family : AF_UNSPEC;
+    if((hints && (hints->ai_flags & AI_NUMERICHOST)) || (family != AF_UNSPEC && family != AF_INET && family != AF_INET6))
+    {
+        return getaddrinfo_f(node, service, hints, res);
+    }
+
+    std::vector<sylar::DnsResolver::Address> addrs;
+    switch(sylar::DnsResolver::GetInstance()->resolve(node, family, addrs))
+    {
+        case sylar::DnsResolver::OK:
+            break;
+        case sylar::DnsResolver::NXDOMAIN:
+            return EAI_NONAME;
+        case sylar::DnsResolver::NODATA:
+            return EAI_NODATA;
+        case sylar::DnsResolver::RETRY:
+            return EAI_AGAIN;
+        default:
+            return EAI_FAIL;
+    }
+
+    // 已经拿到地址 -> 用数字地址调用原始版本处理service/socktype，生成的链表可以直接用freeaddrinfo释放
+    struct addrinfo numeric_hints;
+    memset(&numeric_hints, 0, sizeof(numeric_hints));
+    if(hints)
+    {
+        numeric_hints.ai_flags    = hints->ai_flags;
+        numeric_hints.ai_socktype = hints->ai_socktype;
+        numeric_hints.ai_protocol = hints->ai_protocol;
+    }
+    numeric_hints.ai_flags |= AI_NUMERICHOST;
+
+    *res = nullptr;
+    struct addrinfo** tail = res;
+    for(auto& i : addrs)
+    {
+        char host[INET6_ADDRSTRLEN];
+        inet_ntop(i.family, i.addr, host, sizeof(host));
+        numeric_hints.ai_family = i.family;
+
+        struct addrinfo* ai = nullptr;
+        int rt = getaddrinfo_f(host, service, &numeric_hints, &ai);
+        if(rt)
+        {
+            if(*res)
+            {
+                freeaddrinfo(*res);
+                *res = nullptr;
+            }
+            return rt;
+        }
+        *tail = ai;
+        while(*tail)
+        {
+            tail = &(*tail)->ai_next;
+        }
+    }
+
+    // 规范名使用用户传入的域名，而不是数字地址
+    if((*res)->ai_canonname)
+    {
+        free((*res)->ai_canonname);
+        (*res)->ai_canonname = strdup(node);
+    }
+    return 0;
+}
+
+struct hostent* gethostbyname(const char *name)
+{
+    if(!sylar::t_hook_enable || is_numeric_host(name)) 
+    {
+        return gethostbyname_f(name);
+    }
+
+    std::vector<sylar::DnsResolver::Address> addrs;
+    switch(sylar::DnsResolver::GetInstance()->resolve(name, AF_INET, addrs))
+    {
+        case sylar::DnsResolver::OK:
+            break;
+        case sylar::DnsResolver::NXDOMAIN:
+            h_errno = HOST_NOT_FOUND;
+            return nullptr;
+        case sylar::DnsResolver::NODATA:
+            h_errno = NO_DATA;
+            return nullptr;
+        case sylar::DnsResolver::RETRY:
+            h_errno = TRY_AGAIN;
+            return nullptr;
+        default:
+            h_errno = NO_RECOVERY;
+            return nullptr;
+    }
+
+    // 与原始版本一样返回线程内的静态结果，下一次调用时被覆盖
+    struct HostentBuffer
+    {
+        struct hostent ent;
+        std::string name;
+        std::vector<struct in_addr> addrs;
+        std::vector<char*> addr_list;
+        char* aliases[1] = {nullptr};
+    };
+    static thread_local HostentBuffer t_hostent;
+
+    t_hostent.name = name;
+    t_hostent.addrs.resize(addrs.size());
+    t_hostent.addr_list.clear();
+    for(size_t i = 0; i < addrs.size(); i++)
+    {
+        memcpy(&t_hostent.addrs[i], addrs[i].addr, sizeof(struct in_addr));
+        t_hostent.addr_list.push_back((char*)&t_hostent.addrs[i]);
+    }
+    t_hostent.addr_list.push_back(nullptr);
+
+    t_hostent.ent.h_name      = &t_hostent.name[0];
+    t_hostent.ent.h_aliases   = t_hostent.aliases;
+    t_hostent.ent.h_addrtype  = AF_INET;
+    t_hostent.ent.h_length    = sizeof(struct in_addr);
+    t_hostent.ent.h_addr_list = t_hostent.addr_list.data();
+    return &t_hostent.ent;
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    if(!sylar::t_hook_enable) 
+    {
+        return poll_f(fds, nfds, timeout);
+    }
+    return do_poll(fds, nfds, timeout);
+}
+
+int ppoll(struct pollfd *fds, nfds_t nfds, const struct timespec *tmo_p, const sigset_t *sigmask)
+{
+    // 协程中无法原子地替换信号掩码并等待 -> 带sigmask时调用原始版本
+    if(!sylar::t_hook_enable || sigmask) 
+    {
+        return ppoll_f(fds, nfds, tmo_p, sigmask);
+    }
+
+    int timeout = -1;
+    if(tmo_p)
+    {
+        // 向上取整到毫秒
+        timeout = tmo_p->tv_sec * 1000 + (tmo_p->tv_nsec + 999999) / 1000000;
+    }
+    return do_poll(fds, nfds, timeout);
+}
+
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout)
+{
+    if(!sylar::t_hook_enable) 
+    {
+        return select_f(nfds, readfds, writefds, exceptfds, timeout);
+    }
+
+    // fd_set -> pollfd
+    std::vector<struct pollfd> pfds;
+    for(int fd = 0; fd < nfds; fd++)
+    {
+        short events = 0;
+        if(readfds && FD_ISSET(fd, readfds))
+        {
+            events |= POLLIN;
+        }
+        if(writefds && FD_ISSET(fd, writefds))
+        {
+            events |= POLLOUT;
+        }
+        if(exceptfds && FD_ISSET(fd, exceptfds))
+        {
+            events |= POLLPRI;
+        }
+        if(events)
+        {
+            pfds.push_back({fd, events, 0});
+        }
+    }
+
+    int timeout_ms = -1;
+    if(timeout)
+    {
+        timeout_ms = timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int n = do_poll(pfds.data(), pfds.size(), timeout_ms);
+    if(n < 0)
+    {
+        return n;
+    }
+
+    // pollfd -> fd_set
+    for(auto& i : pfds)
+    {
+        if(i.revents & POLLNVAL)
+        {
+            errno = EBADF;
+            return -1;
+        }
+    }
+    n = 0;
+    for(auto& i : pfds)
+    {
+        if(readfds && FD_ISSET(i.fd, readfds))
+        {
+            if(i.revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                n++;
+            }
+            else
+            {
+                FD_CLR(i.fd, readfds);
+            }
+        }
+        if(writefds && FD_ISSET(i.fd, writefds))
+        {
+            if(i.revents & (POLLOUT | POLLERR))
+            {
+                n++;
+            }
+            else
+            {
+                FD_CLR(i.fd, writefds);
+            }
+        }
+        if(exceptfds && FD_ISSET(i.fd, exceptfds))
+        {
+            if(i.revents & POLLPRI)
+            {
+                n++;
+            }
+            else
+            {
+                FD_CLR(i.fd, exceptfds);
+            }
+        }
+    }
+
+    // 与Linux的select一致，返回时timeout为剩余时间
+    if(timeout)
+    {
+        auto used = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        int64_t left = std::max<int64_t>((int64_t)timeout->tv_sec * 1000000 + timeout->tv_usec - used, 0);
+        timeout->tv_sec  = left / 1000000;
+        timeout->tv_usec = left % 1000000;
+    }
+    return n;
+}
+
+// 嵌套的epoll：epfd本身可以被epoll监听，有就绪事件时epfd可读
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+    if(!sylar::t_hook_enable) 
+    {
+        return epoll_wait_f(epfd, events, maxevents, timeout);
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    while(true)
+    {
+        int n = epoll_wait_f(epfd, events, maxevents, 0);
+        if(n != 0 || timeout == 0)
+        {
+            return n;
+        }
+
+        int remaining = timeout;
+        if(timeout > 0)
+        {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            remaining = std::max((int)left.count(), 0);
+        }
+
+        struct pollfd pfd = {epfd, POLLIN, 0};
+        int rt = do_poll(&pfd, 1, remaining);
+        if(rt <= 0)
+        {
+            return rt;
+        }
+        // 另一个等待者可能已经取走了事件 -> 在剩余时间内继续等待
+        if(timeout > 0 && std::chrono::steady_clock::now() >= deadline)
+        {
+            return epoll_wait_f(epfd, events, maxevents, 0);
+        }
+    }
+}
+
+}
\ No newline at end of file
@@ -7,6 +7,12 @@
 #include <sys/uio.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
 
 namespace sylar{
 
@@ -42,6 +48,30 @@ extern "C"
 	typedef int (*accept_fun) (int sockfd, struct sockaddr *addr, socklen_t *addrlen);
 	extern accept_fun accept_f;
 
+	typedef int (*accept4_fun) (int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
+	extern accept4_fun accept4_f;
+
+	typedef int (*socketpair_fun) (int domain, int type, int protocol, int sv[2]);
+	extern socketpair_fun socketpair_f;
+
+	typedef int (*pipe_fun) (int pipefd[2]);
+	extern pipe_fun pipe_f;
+
+	typedef int (*pipe2_fun) (int pipefd[2], int flags);
+	extern pipe2_fun pipe2_f;
+
+	typedef int (*eventfd_fun) (unsigned int initval, int flags);
+	extern eventfd_fun eventfd_f;
+
+	typedef int (*dup_fun) (int oldfd);
+	extern dup_fun dup_f;
+
+	typedef int (*dup2_fun) (int oldfd, int newfd);
+	extern dup2_fun dup2_f;
+
+	typedef int (*dup3_fun) (int oldfd, int newfd, int flags);
+	extern dup3_fun dup3_f;
+
 	typedef ssize_t (*read_fun) (int fd, void *buf, size_t count);
 	extern read_fun read_f;
 
@@ -57,6 +87,9 @@ extern "C"
 	typedef ssize_t (*recvmsg_fun) (int sockfd, struct msghdr *msg, int flags);
 	extern recvmsg_fun recvmsg_f;
 
+	typedef int (*recvmmsg_fun) (int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout);
+	extern recvmmsg_fun recvmmsg_f;
+
 	typedef ssize_t (*write_fun) (int fd, const void *buf, size_t count);
 	extern write_fun write_f;
 
@@ -72,6 +105,21 @@ extern "C"
 	typedef ssize_t (*sendmsg_fun) (int sockfd, const struct msghdr *msg, int flags);
 	extern sendmsg_fun sendmsg_f;
 
+	typedef int (*sendmmsg_fun) (int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+	extern sendmmsg_fun sendmmsg_f;
+
+	typedef ssize_t (*sendfile_fun) (int out_fd, int in_fd, off_t *offset, size_t count);
+	extern sendfile_fun sendfile_f;
+
+	typedef ssize_t (*splice_fun) (int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags);
+	extern splice_fun splice_f;
+
+	typedef ssize_t (*tee_fun) (int fd_in, int fd_out, size_t len, unsigned int flags);
+	extern tee_fun tee_f;
+
+	typedef ssize_t (*copy_file_range_fun) (int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags);
+	extern copy_file_range_fun copy_file_range_f;
+
 	typedef int (*close_fun) (int fd);
 	extern close_fun close_f;
 
@@ -87,6 +135,24 @@ extern "C"
     typedef int (*setsockopt_fun) (int sockfd, int level, int optname, const void *optval, socklen_t optlen);
     extern setsockopt_fun setsockopt_f;
 
+	typedef int (*getaddrinfo_fun) (const char *node, const char *service, const struct addrinfo *hints, struct addrinfo **res);
+	extern getaddrinfo_fun getaddrinfo_f;
+
+	typedef struct hostent* (*gethostbyname_fun) (const char *name);
+	extern gethostbyname_fun gethostbyname_f;
+
+	typedef int (*poll_fun) (struct pollfd *fds, nfds_t nfds, int timeout);
+	extern poll_fun poll_f;
+
+	typedef int (*ppoll_fun) (struct pollfd *fds, nfds_t nfds, const struct timespec *tmo_p, const sigset_t *sigmask);
+	extern ppoll_fun ppoll_f;
+
+	typedef int (*select_fun) (int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout);
+	extern select_fun select_f;
+
+	typedef int (*epoll_wait_fun) (int epfd, struct epoll_event *events, int maxevents, int timeout);
+	extern epoll_wait_fun epoll_wait_f;
+
     // function prototype -> 对应.h中已经存在 可以省略
 	// sleep function 
 	unsigned int sleep(unsigned int seconds);
@@ -97,6 +163,13 @@ extern "C"
 	int socket(int domain, int type, int protocol);
 	int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
 	int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
+	int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
+	int socketpair(int domain, int type, int protocol, int sv[2]);
+
+	// pipe and eventfd
+	int pipe(int pipefd[2]);
+	int pipe2(int pipefd[2], int flags);
+	int eventfd(unsigned int initval, int flags);
 
 	// read 
 	ssize_t read(int fd, void *buf, size_t count);
@@ -105,6 +178,7 @@ extern "C"
     ssize_t recv(int sockfd, void *buf, size_t len, int flags);
     ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen);
     ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags);
+    int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout);
 
     // write
     ssize_t write(int fd, const void *buf, size_t count);
@@ -113,9 +187,19 @@ extern "C"
     ssize_t send(int sockfd, const void *buf, size_t len, int flags);
     ssize_t sendto(int sockfd, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, socklen_t addrlen);
     ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags);
+    int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+
+    // zero copy
+    ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count);
+    ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags);
+    ssize_t tee(int fd_in, int fd_out, size_t len, unsigned int flags);
+    ssize_t copy_file_range(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags);
 
     // fd
     int close(int fd);
+    int dup(int oldfd);
+    int dup2(int oldfd, int newfd);
+    int dup3(int oldfd, int newfd, int flags);
 
     // socket control
     int fcntl(int fd, int cmd, ... /* arg */ );
@@ -123,5 +207,15 @@ extern "C"
 
     int getsockopt(int sockfd, int level, int optname, void *optval, socklen_t *optlen);
     int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t optlen);
+
+    // dns
+    int getaddrinfo(const char *node, const char *service, const struct addrinfo *hints, struct addrinfo **res);
+    struct hostent* gethostbyname(const char *name);
+
+    // multiplexing
+    int poll(struct pollfd *fds, nfds_t nfds, int timeout);
+    int ppoll(struct pollfd *fds, nfds_t nfds, const struct timespec *tmo_p, const sigset_t *sigmask);
+    int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout);
+    int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout);
 }
 #endif
\ No newline at end of file
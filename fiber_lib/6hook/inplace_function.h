@@ -0,0 +1,210 @@
+#ifndef _INPLACE_FUNCTION_H_
+#define _INPLACE_FUNCTION_H_
+
+#include <new>
+#include <cstddef>
+#include <utility>
+#include <typeinfo>
+#include <functional>
+#include <type_traits>
+
+namespace sylar {
+
+template<class Signature, size_t Capacity = 64>
+class InplaceFunction;
+
+// 只能移动的std::function：可调用对象不超过Capacity字节（且移动不抛异常）时直接存放在对象内部，不分配内存
+// 超过时退化为堆上分配；std::function只内联16字节，捕获几个指针和shared_ptr的lambda就需要malloc
+// 不可拷贝 -> 任务队列的入队、出队都是移动
+template<class R, class... Args, size_t Capacity>
+class InplaceFunction<R(Args...), Capacity>
+{
+public:
+	InplaceFunction() {}
+	InplaceFunction(std::nullptr_t) {}
+
+	template<class F, class D = typename std::decay<F>::type,
+		class = typename std::enable_if<!std::is_same<D, InplaceFunction>::value && std::is_invocable_r<R, D&, Args...>::value>::type>
+	InplaceFunction(F&& f)
+	{
+		if(IsNull(f))
+		{
+			return;
+		}
+		if constexpr(IsInline<D>())
+		{
+			new (m_storage) D(std::forward<F>(f));
+			m_ops = &InlineOps<D>::s_ops;
+		}
+		else
+		{
+			*(D**)m_storage = new D(std::forward<F>(f));
+			m_ops = &HeapOps<D>::s_ops;
+		}
+	}
+
+	InplaceFunction(InplaceFunction&& rhs) noexcept
+	{
+		moveFrom(rhs);
+	}
+
+	InplaceFunction& operator=(InplaceFunction&& rhs) noexcept
+	{
+		if(this != &rhs)
+		{
+			reset();
+			moveFrom(rhs);
+		}
+		return *this;
+	}
+
+	InplaceFunction& operator=(std::nullptr_t)
+	{
+		reset();
+		return *this;
+	}
+
+	template<class F, class D = typename std::decay<F>::type,
+		class = typename std::enable_if<!std::is_same<D, InplaceFunction>::value && std::is_invocable_r<R, D&, Args...>::value>::type>
+	InplaceFunction& operator=(F&& f)
+	{
+		return *this = InplaceFunction(std::forward<F>(f));
+	}
+
+	~InplaceFunction()
+	{
+		reset();
+	}
+
+	InplaceFunction(const InplaceFunction&) = delete;
+	InplaceFunction& operator=(const InplaceFunction&) = delete;
+
+	// 与std::function一样是const的，mutable lambda也可以调用
+	R operator()(Args... args) const
+	{
+		if(!m_ops)
+		{
+			throw std::bad_function_call();
+		}
+		return m_ops->invoke(m_storage, std::forward<Args>(args)...);
+	}
+
+	explicit operator bool() const {return m_ops != nullptr;}
+
+	// 与std::function一致：保存的可调用对象的类型，为空时返回typeid(void)
+	const std::type_info& target_type() const {return m_ops ? *m_ops->type : typeid(void);}
+
+	void swap(InplaceFunction& rhs)
+	{
+		InplaceFunction tmp(std::move(rhs));
+		rhs = std::move(*this);
+		*this = std::move(tmp);
+	}
+
+	friend bool operator==(const InplaceFunction& f, std::nullptr_t) {return !f;}
+	friend bool operator!=(const InplaceFunction& f, std::nullptr_t) {return (bool)f;}
+
+private:
+	// 类型擦除后的操作表，每种可调用类型一份
+	struct Ops
+	{
+		R (*invoke)(void* storage, Args&&... args);
+		// 把src中的对象移动到dst，并销毁src中的对象
+		void (*relocate)(void* dst, void* src);
+		void (*destroy)(void* storage);
+		const std::type_info* type;
+	};
+
+	template<class D>
+	static constexpr bool IsInline()
+	{
+		return sizeof(D) <= Capacity && alignof(D) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible<D>::value;
+	}
+
+	template<class D>
+	struct InlineOps
+	{
+		static R Invoke(void* storage, Args&&... args)
+		{
+			return (*(D*)storage)(std::forward<Args>(args)...);
+		}
+		static void Relocate(void* dst, void* src)
+		{
+			new (dst) D(std::move(*(D*)src));
+			((D*)src)->~D();
+		}
+		static void Destroy(void* storage)
+		{
+			((D*)storage)->~D();
+		}
+		static constexpr Ops s_ops = {&Invoke, &Relocate, &Destroy, &typeid(D)};
+	};
+
+	template<class D>
+	struct HeapOps
+	{
+		static R Invoke(void* storage, Args&&... args)
+		{
+			return (**(D**)storage)(std::forward<Args>(args)...);
+		}
+		static void Relocate(void* dst, void* src)
+		{
+			*(D**)dst = *(D**)src;
+		}
+		static void Destroy(void* storage)
+		{
+			delete *(D**)storage;
+		}
+		static constexpr Ops s_ops = {&Invoke, &Relocate, &Destroy, &typeid(D)};
+	};
+
+	// 空的函数指针和std::function构造出空的InplaceFunction，与std::function一致
+	template<class F>
+	static bool IsNull(const F& f)
+	{
+		if constexpr(std::is_pointer<F>::value || std::is_member_pointer<F>::value)
+		{
+			return f == nullptr;
+		}
+		else if constexpr(std::is_same<F, std::function<R(Args...)>>::value)
+		{
+			return !f;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	void moveFrom(InplaceFunction& rhs)
+	{
+		m_ops = rhs.m_ops;
+		if(m_ops)
+		{
+			m_ops->relocate(m_storage, rhs.m_storage);
+			rhs.m_ops = nullptr;
+		}
+	}
+
+	void reset()
+	{
+		if(m_ops)
+		{
+			m_ops->destroy(m_storage);
+			m_ops = nullptr;
+		}
+	}
+
+private:
+	static_assert(Capacity >= sizeof(void*), "InplaceFunction capacity must hold a pointer");
+
+	alignas(std::max_align_t) mutable unsigned char m_storage[Capacity];
+	const Ops* m_ops = nullptr;
+};
+
+// 调度器任务、定时器和IO事件的回调
+typedef InplaceFunction<void(), 64> Callback;
+
+}
+
+#endif
@@ -36,23 +36,32 @@ void IOManager::FdContext::resetEventContext(EventContext &ctx)
 }
 
 // no lock
-void IOManager::FdContext::triggerEvent(IOManager::Event event) {
+void IOManager::FdContext::triggerEvent(IOManager::Event event, uint64_t event_ticks) {
     assert(events & event);   //是否已经注册
+    Metrics::Inc(Metrics::EVENTS_TRIGGERED);
 
     // delete event 如果注册了，则删除，表示该事件已经被处理
     events = (Event)(events & ~event);
     
     // trigger
     EventContext& ctx = getEventContext(event);
+    if(Tracer::Enabled())
+    {
+        uint64_t id = ctx.fiber ? ctx.fiber->getId() : 0;
+        if(Tracer::Sampled(id))
+        {
+            Tracer::Record(Tracer::TRIGGER, id, fd, event);
+        }
+    }
     if (ctx.cb) 
     {
-        // call ScheduleTask(std::function<void()>* f, int thr)
-        ctx.scheduler->scheduleLock(&ctx.cb);
+        // call ScheduleTask(Callback* f, int thr)
+        ctx.scheduler->scheduleLock(&ctx.cb, -1, event_ticks);
     } 
     else 
     {
-        // call ScheduleTask(std::shared_ptr<Fiber>* f, int thr)
-        ctx.scheduler->scheduleLock(&ctx.fiber);
+        // call ScheduleTask(RefPtr<Fiber>* f, int thr)
+        ctx.scheduler->scheduleLock(&ctx.fiber, -1, event_ticks);
     }
 
     // reset event context
@@ -67,8 +76,8 @@ Scheduler(threads, use_caller, name), TimerManager()   //调用初始化基类
     m_epfd = epoll_create(5000);
     assert(m_epfd > 0);
 
-    // create pipe
-    int rt = pipe(m_tickleFds);
+    // create pipe -> 调用原始版本，tickle管道由IOManager自己管理，不能交给hook
+    int rt = pipe_f(m_tickleFds);
     assert(!rt);
 
     // add read event to epoll
@@ -119,7 +128,7 @@ void IOManager::contextResize(size_t size)
     }
 }
 
-int IOManager::addEvent(int fd, Event event, std::function<void()> cb) 
+int IOManager::addEvent(int fd, Event event, Callback cb) 
 {
     // attemp to find FdContext 
     FdContext *fd_ctx = nullptr;
@@ -177,6 +186,15 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
         event_ctx.fiber = Fiber::GetThis();
         assert(event_ctx.fiber->getState() == Fiber::RUNNING);
     }
+    if(Tracer::Enabled())
+    {
+        // 回调等待记为协程0
+        uint64_t id = event_ctx.fiber ? event_ctx.fiber->getId() : 0;
+        if(Tracer::Sampled(id))
+        {
+            Tracer::Record(Tracer::ADD_EVENT, id, fd, event);
+        }
+    }
     return 0;
 }
 
@@ -341,6 +359,11 @@ void IOManager::tickle()
     }
     int rt = write(m_tickleFds[1], "T", 1);
     assert(rt == 1);
+    Metrics::Inc(Metrics::TICKLES_SENT);
+    if(Tracer::Enabled())
+    {
+        Tracer::Record(Tracer::TICKLE, 0, 0);
+    }
 }
 
 bool IOManager::stopping() 
@@ -353,6 +376,8 @@ bool IOManager::stopping()
 
 void IOManager::idle() 
 {    
+    // 统计中的运行时间包括阻塞在epoll_wait中的时间
+    Fiber::SetTaskName("sylar::IOManager::idle");
      //⼀次epoll_wait最多检测256个就绪事件，如果就绪事件超过了这个数，那么会在下轮epoll_wati继续处理
     static const uint64_t MAX_EVNETS = 256;
     std::unique_ptr<epoll_event[]> events(new epoll_event[MAX_EVNETS]);
@@ -369,13 +394,23 @@ void IOManager::idle()
 
         // blocked at epoll_wait
         int rt = 0;
+        // epoll_wait返回的时刻 -> 本轮触发的事件从这里开始计算延迟
+        uint64_t wake_ticks = 0;
         while(true)
         {
             static const uint64_t MAX_TIMEOUT = 5000;
             uint64_t next_timeout = getNextTimer();
             next_timeout = std::min(next_timeout, MAX_TIMEOUT);
-            // 阻塞在epoll_wait上，等待事件发⽣
-            rt = epoll_wait(m_epfd, events.get(), MAX_EVNETS, (int)next_timeout);
+            // 阻塞在epoll_wait上，等待事件发⽣ -> 调用原始版本，hook后的epoll_wait会挂起idle协程
+            uint64_t wait_start = Fiber::Ticks();
+            rt = epoll_wait_f(m_epfd, events.get(), MAX_EVNETS, (int)next_timeout);
+            wake_ticks = Fiber::Ticks();
+            Metrics::Inc(Metrics::EPOLL_WAITS);
+            Metrics::Inc(Metrics::EPOLL_WAIT_TICKS, wake_ticks - wait_start);
+            if(Tracer::Enabled())
+            {
+                Tracer::Record(Tracer::EPOLL_WAIT, rt > 0 ? rt : 0, wake_ticks - wait_start, 0, wait_start);
+            }
             // EINTR -> retry
             if(rt < 0 && errno == EINTR)  // EINTR：信号中断
             {
@@ -387,14 +422,23 @@ void IOManager::idle()
             }
         };
 
+        if(rt > 0)
+        {
+            Metrics::Inc(Metrics::EPOLL_EVENTS, rt);
+        }
+
         // collect all timers overdue
-        std::vector<std::function<void()>> cbs;
+        std::vector<Callback> cbs;
         listExpiredCb(cbs);
         if(!cbs.empty()) 
         {
-            for(const auto& cb : cbs) 
+            if(Tracer::Enabled())
+            {
+                Tracer::Record(Tracer::TIMER_FIRE, 0, cbs.size());
+            }
+            for(auto& cb : cbs) 
             {
-                scheduleLock(cb);
+                scheduleLock(std::move(cb));
             }
             cbs.clear();
         }
@@ -410,6 +454,7 @@ void IOManager::idle()
                 uint8_t dummy[256];
                 // ticklefd[0]⽤于通知协程调度，这时只需要把管道⾥的内容读完即可，本轮idle结束Scheduler::run会重新执⾏协程调度
                 while (read(m_tickleFds[0], dummy, sizeof(dummy)) > 0);
+                Metrics::Inc(Metrics::TICKLES_RECEIVED);
                 continue;
             }
 
@@ -453,17 +498,17 @@ void IOManager::idle()
             // schedule callback and update fdcontext and event context
             if (real_events & READ) 
             {
-                fd_ctx->triggerEvent(READ);
+                fd_ctx->triggerEvent(READ, wake_ticks);
                 --m_pendingEventCount;
             }
             if (real_events & WRITE) 
             {
-                fd_ctx->triggerEvent(WRITE);
+                fd_ctx->triggerEvent(WRITE, wake_ticks);
                 --m_pendingEventCount;
             }
         } // end for
         // ⼀旦处理完所有的事件， idle协程yield，这样可以让调度协程(Scheduler::run)重新检查是否有新任务要调度
-        Fiber::GetThis()->yield();   //执行完后让出CPU
+        Fiber::Current()->yield();   //执行完后让出CPU
   
     } // end while(true)
 }
@@ -30,9 +30,9 @@ private:
             // scheduler     调度器
             Scheduler *scheduler = nullptr;
             // callback fiber  协程
-            std::shared_ptr<Fiber> fiber;
+            RefPtr<Fiber> fiber;
             // callback function    回调函数
-            std::function<void()> cb;
+            Callback cb;
         };
 
         // read event context
@@ -46,7 +46,8 @@ private:
 
         EventContext& getEventContext(Event event);
         void resetEventContext(EventContext &ctx);
-        void triggerEvent(Event event); 
+        // event_ticks：epoll_wait返回的时刻，取消触发时为0
+        void triggerEvent(Event event, uint64_t event_ticks = 0); 
     };
 
 public:
@@ -54,7 +55,7 @@ public:
     ~IOManager();
 
     // add one event at a time
-    int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
+    int addEvent(int fd, Event event, Callback cb = nullptr);
     // delete event
     bool delEvent(int fd, Event event);
     // delete the event and trigger its callback
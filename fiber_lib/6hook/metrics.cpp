@@ -0,0 +1,251 @@
+#include "metrics.h"
+#include "fiber.h"
+
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace sylar {
+
+uint64_t LatencyHistogram::UpperBound(int i)
+{
+	if(i >= BUCKETS - 1)
+	{
+		return UINT64_MAX;
+	}
+	if(i < SUB_COUNT)
+	{
+		return i + 1;
+	}
+	int shift = i / SUB_COUNT - 1;
+	uint64_t sub = i % SUB_COUNT;
+	return (SUB_COUNT + sub + 1) << shift;
+}
+
+thread_local Metrics::Slot* Metrics::t_slot = nullptr;
+
+// 所有创建过的Slot（只增加，不释放）和已退出线程归还的Slot
+static std::mutex s_slotsMutex;
+static Metrics::Slot* s_slots = nullptr;
+static std::vector<Metrics::Slot*> s_freeSlots;
+static size_t s_attached = 0;
+
+// 线程退出（thread_local析构）之后仍可能有指标写入 -> 写到这份共享的Slot中
+// 多个线程同时写时可能丢失计数，但都是原子操作，没有数据竞争
+static Metrics::Slot s_orphan;
+static thread_local bool t_detached = false;
+
+namespace {
+
+// 线程退出时归还Slot
+struct SlotHolder
+{
+	Metrics::Slot* slot = nullptr;
+
+	~SlotHolder()
+	{
+		t_detached = true;
+		if(slot)
+		{
+			std::lock_guard<std::mutex> lock(s_slotsMutex);
+			s_freeSlots.push_back(slot);
+			s_attached--;
+		}
+	}
+};
+
+thread_local SlotHolder t_holder;
+
+}
+
+Metrics::Slot* Metrics::Attach()
+{
+	if(t_detached)
+	{
+		return &s_orphan;
+	}
+
+	Slot* slot;
+	{
+		std::lock_guard<std::mutex> lock(s_slotsMutex);
+		if(!s_freeSlots.empty())
+		{
+			slot = s_freeSlots.back();
+			s_freeSlots.pop_back();
+		}
+		else
+		{
+			slot = new Slot;
+			slot->next = s_slots;
+			s_slots = slot;
+		}
+		s_attached++;
+	}
+	t_holder.slot = slot;
+	t_slot = slot;
+	return slot;
+}
+
+void Metrics::Hook(const char* name, bool eagain)
+{
+	Slot* slot = Local();
+	// 按指针散列：同一个hook函数总是传入同一个字符串常量
+	size_t i = ((uintptr_t)name >> 3) * 0x9E3779B97F4A7C15ull >> 58;
+	for(size_t n = 0; n < MAX_HOOKS; n++, i = (i + 1) % MAX_HOOKS)
+	{
+		HookCounters& h = slot->hooks[i];
+		const char* cur = h.name.load(std::memory_order_acquire);
+		if(!cur)
+		{
+			h.name.store(name, std::memory_order_release);
+		}
+		else if(cur != name)
+		{
+			continue;
+		}
+		h.calls.add();
+		if(eagain)
+		{
+			h.eagain.add();
+		}
+		return;
+	}
+}
+
+static const char* const s_counterNames[Metrics::COUNTER_MAX][2] =
+{
+	{"sylar_tasks_executed_total", "Tasks (fibers and callbacks) run by scheduler workers."},
+	{"sylar_tickles_sent_total", "Wakeups written to the IOManager tickle pipe."},
+	{"sylar_tickles_received_total", "Wakeups read from the tickle pipe by idle workers."},
+	{"sylar_epoll_waits_total", "epoll_wait calls made by idle workers."},
+	{"sylar_epoll_events_total", "Events returned by epoll_wait, including the tickle pipe."},
+	{"sylar_epoll_wait_seconds_total", "Time idle workers spent blocked in epoll_wait."},
+	{"sylar_events_triggered_total", "Read/write events triggered by readiness or cancellation."},
+	{"sylar_timers_fired_total", "Timer callbacks taken from the timer heap."},
+	{"sylar_timers_cancelled_total", "Timers cancelled before firing."}
+};
+
+static const char* const s_histogramNames[Metrics::HISTOGRAM_MAX][2] =
+{
+	{"sylar_queue_wait_seconds", "Time from a task entering the scheduler queue until it starts running."},
+	{"sylar_event_to_resume_seconds", "Time from epoll_wait reporting an event until its waiter starts running."}
+};
+
+// 导出的直方图桶上界（秒）
+static const double s_bucketBounds[] =
+{
+	1e-6, 2.5e-6, 5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4,
+	1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+
+void Metrics::WritePrometheus(std::ostream& os)
+{
+	uint64_t counters[COUNTER_MAX] = {0};
+	std::vector<uint64_t> buckets(HISTOGRAM_MAX * LatencyHistogram::BUCKETS, 0);
+	uint64_t sums[HISTOGRAM_MAX] = {0};
+	std::map<std::string, std::pair<uint64_t, uint64_t>> hooks;
+	size_t threads;
+
+	{
+		std::lock_guard<std::mutex> lock(s_slotsMutex);
+		threads = s_attached;
+		for(Slot* slot = s_slots; ; slot = slot->next)
+		{
+			// 最后合并共享的s_orphan
+			Slot* cur = slot ? slot : &s_orphan;
+			for(int c = 0; c < COUNTER_MAX; c++)
+			{
+				counters[c] += cur->counters[c].get();
+			}
+			for(int h = 0; h < HISTOGRAM_MAX; h++)
+			{
+				for(int i = 0; i < LatencyHistogram::BUCKETS; i++)
+				{
+					buckets[h * LatencyHistogram::BUCKETS + i] += cur->histograms[h].bucket(i);
+				}
+				sums[h] += cur->histograms[h].sum();
+			}
+			for(int i = 0; i < MAX_HOOKS; i++)
+			{
+				const char* name = cur->hooks[i].name.load(std::memory_order_acquire);
+				if(name)
+				{
+					auto& v = hooks[name];
+					v.first += cur->hooks[i].calls.get();
+					v.second += cur->hooks[i].eagain.get();
+				}
+			}
+			if(!slot)
+			{
+				break;
+			}
+		}
+	}
+
+	for(int c = 0; c < COUNTER_MAX; c++)
+	{
+		os << "# HELP " << s_counterNames[c][0] << " " << s_counterNames[c][1] << "\n";
+		os << "# TYPE " << s_counterNames[c][0] << " counter\n";
+		if(c == EPOLL_WAIT_TICKS)
+		{
+			os << s_counterNames[c][0] << " " << Fiber::TicksToNs(counters[c]) / 1e9 << "\n";
+		}
+		else
+		{
+			os << s_counterNames[c][0] << " " << counters[c] << "\n";
+		}
+	}
+
+	for(int h = 0; h < HISTOGRAM_MAX; h++)
+	{
+		const char* name = s_histogramNames[h][0];
+		const uint64_t* hist = &buckets[h * LatencyHistogram::BUCKETS];
+		os << "# HELP " << name << " " << s_histogramNames[h][1] << "\n";
+		os << "# TYPE " << name << " histogram\n";
+		uint64_t cumulative = 0;
+		int i = 0;
+		for(double bound : s_bucketBounds)
+		{
+			// 上界不超过bound的桶都计入（分桶的相对误差之内）
+			while(i < LatencyHistogram::BUCKETS - 1 && Fiber::TicksToNs(LatencyHistogram::UpperBound(i)) <= bound * 1e9)
+			{
+				cumulative += hist[i++];
+			}
+			os << name << "_bucket{le=\"" << bound << "\"} " << cumulative << "\n";
+		}
+		for(; i < LatencyHistogram::BUCKETS; i++)
+		{
+			cumulative += hist[i];
+		}
+		os << name << "_bucket{le=\"+Inf\"} " << cumulative << "\n";
+		os << name << "_sum " << Fiber::TicksToNs(sums[h]) / 1e9 << "\n";
+		os << name << "_count " << cumulative << "\n";
+	}
+
+	os << "# HELP sylar_hook_calls_total Hooked I/O calls that reached the non-blocking syscall, by function.\n";
+	os << "# TYPE sylar_hook_calls_total counter\n";
+	for(auto& i : hooks)
+	{
+		os << "sylar_hook_calls_total{syscall=\"" << i.first << "\"} " << i.second.first << "\n";
+	}
+	os << "# HELP sylar_hook_eagain_total Hooked I/O calls that returned EAGAIN and parked the fiber, by function.\n";
+	os << "# TYPE sylar_hook_eagain_total counter\n";
+	for(auto& i : hooks)
+	{
+		os << "sylar_hook_eagain_total{syscall=\"" << i.first << "\"} " << i.second.second << "\n";
+	}
+
+	os << "# HELP sylar_metrics_threads Threads currently recording metrics.\n";
+	os << "# TYPE sylar_metrics_threads gauge\n";
+	os << "sylar_metrics_threads " << threads << "\n";
+}
+
+std::string Metrics::ToPrometheus()
+{
+	std::ostringstream ss;
+	WritePrometheus(ss);
+	return ss.str();
+}
+
+}
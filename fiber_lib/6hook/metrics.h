@@ -0,0 +1,146 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace sylar {
+
+// 单写者计数器：只由所属线程写入（不需要原子的读-改-写），其他线程随时读取
+class MetricCounter
+{
+public:
+	void add(uint64_t n = 1) {m_value.store(m_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);}
+	uint64_t get() const {return m_value.load(std::memory_order_relaxed);}
+
+private:
+	std::atomic<uint64_t> m_value{0};
+};
+
+// 对数-线性分桶的延迟直方图（HdrHistogram的简化版），单写者
+// 每个2的幂区间再等分为2^SUB_BITS个桶 -> 相对误差不超过1/2^SUB_BITS，记录一次只是一次数组下标计算和一次写入
+// 记录的单位是Fiber::Ticks()的时钟周期，导出时再换算为纳秒
+class LatencyHistogram
+{
+public:
+	// 整数常量而不是枚举：与Metrics::Histogram等枚举相乘时不是枚举之间的运算（C++20中已弃用）
+	static constexpr int SUB_BITS = 4;
+	static constexpr int SUB_COUNT = 1 << SUB_BITS;
+	// 不小于2^MAX_BITS的值记录在最后一个桶中
+	static constexpr int MAX_BITS = 48;
+	static constexpr int BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT;
+
+	void record(uint64_t v)
+	{
+		m_buckets[Index(v)].add();
+		m_sum.add(v);
+	}
+
+	// 第i个桶中的值都小于它的上界
+	static uint64_t UpperBound(int i);
+
+	uint64_t bucket(int i) const {return m_buckets[i].get();}
+	uint64_t sum() const {return m_sum.get();}
+
+private:
+	static int Index(uint64_t v)
+	{
+		if(v < SUB_COUNT)
+		{
+			return (int)v;
+		}
+		int shift = 63 - __builtin_clzll(v) - SUB_BITS;
+		if(shift >= MAX_BITS - SUB_BITS)
+		{
+			return BUCKETS - 1;
+		}
+		return (shift + 1) * SUB_COUNT + (int)((v >> shift) - SUB_COUNT);
+	}
+
+private:
+	MetricCounter m_buckets[BUCKETS];
+	MetricCounter m_sum;
+};
+
+// 调度器和IOManager的运行指标
+// 每个线程写自己的一份（按缓存行对齐，互不干扰），读取时合并；线程退出后它的那份留给之后的新线程继续累加 -> 计数单调递增
+class Metrics
+{
+public:
+	enum Counter
+	{
+		// 调度器执行的任务数（协程和回调）
+		TASKS_EXECUTED,
+		// IOManager::tickle()写入管道的次数
+		TICKLES_SENT,
+		// idle从管道读到通知的次数
+		TICKLES_RECEIVED,
+		EPOLL_WAITS,
+		// epoll_wait返回的事件数（包括tickle管道）
+		EPOLL_EVENTS,
+		// 阻塞在epoll_wait中的时间，单位为时钟周期 -> 与线程数、运行时间一起估计线程利用率
+		EPOLL_WAIT_TICKS,
+		// 因就绪或取消而触发的读写事件数
+		EVENTS_TRIGGERED,
+		TIMERS_FIRED,
+		TIMERS_CANCELLED,
+		COUNTER_MAX
+	};
+
+	enum Histogram
+	{
+		// 任务从入队到开始执行
+		QUEUE_WAIT,
+		// epoll_wait返回就绪事件到等待它的协程（或回调）开始执行
+		EVENT_TO_RESUME,
+		HISTOGRAM_MAX
+	};
+
+	// hook中一种系统调用的计数，name为hook函数名（字符串常量）
+	struct HookCounters
+	{
+		std::atomic<const char*> name{nullptr};
+		MetricCounter calls;
+		MetricCounter eagain;
+	};
+
+	enum {MAX_HOOKS = 64};
+
+	// 一个线程的指标
+	struct alignas(64) Slot
+	{
+		MetricCounter counters[COUNTER_MAX];
+		LatencyHistogram histograms[HISTOGRAM_MAX];
+		// 按name指针散列的开放寻址表，只由所属线程插入
+		HookCounters hooks[MAX_HOOKS];
+		Slot* next = nullptr;
+	};
+
+	static void Inc(Counter c, uint64_t n = 1) {Local()->counters[c].add(n);}
+	// ticks为Fiber::Ticks()的差值
+	static void Record(Histogram h, uint64_t ticks) {Local()->histograms[h].record(ticks);}
+	// 一次hook调用，eagain表示返回了EAGAIN（需要等待事件）
+	static void Hook(const char* name, bool eagain);
+
+	// 以Prometheus文本格式输出合并后的指标
+	static void WritePrometheus(std::ostream& os);
+	static std::string ToPrometheus();
+
+private:
+	static Slot* Local()
+	{
+		return t_slot ? t_slot : Attach();
+	}
+
+	// 为当前线程取得一份指标（重用已退出线程的或新建），线程退出时归还
+	static Slot* Attach();
+
+private:
+	static thread_local Slot* t_slot;
+};
+
+}
+
+#endif
@@ -0,0 +1,161 @@
+#include "offload.h"
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+
+static bool debug = false;
+
+namespace sylar {
+
+// 当前线程是否为卸载线程，卸载线程上再次offload时直接执行
+static thread_local bool t_is_offload_thread = false;
+
+OffloadPool* OffloadPool::GetInstance()
+{
+	// 与Singleton一致，不在进程退出时析构，避免join仍在阻塞的任务
+	static OffloadPool* s_pool = new OffloadPool();
+	return s_pool;
+}
+
+bool OffloadPool::IsOffloadThread()
+{
+	return t_is_offload_thread;
+}
+
+OffloadPool::OffloadPool(size_t max_threads, uint64_t idle_timeout_ms, const std::string& name):
+m_name(name), m_maxThreads(max_threads), m_idleTimeout(idle_timeout_ms)
+{
+	assert(max_threads > 0);
+}
+
+OffloadPool::~OffloadPool()
+{
+	std::list<std::shared_ptr<Thread>> thrs;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+		thrs.swap(m_threads);
+		thrs.splice(thrs.end(), m_exited);
+	}
+	m_cond.notify_all();
+
+	// 工作线程会先执行完队列中剩余的任务再退出
+	for(auto& i : thrs)
+	{
+		i->join();
+	}
+	if(debug) std::cout << "OffloadPool::~OffloadPool() success\n";
+}
+
+void OffloadPool::submit(Callback job)
+{
+	std::list<std::shared_ptr<Thread>> exited;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		assert(!m_stopping);
+
+		m_jobs.push_back(std::move(job));
+		m_submitted++;
+		m_maxQueued = std::max(m_maxQueued, m_jobs.size());
+
+		// 空闲线程不够处理排队任务 -> 扩容
+		if(m_idleCount < m_jobs.size() && m_threads.size() < m_maxThreads)
+		{
+			// Thread构造函数会等待线程启动，新线程在此之后才会获取m_mutex，因此可以持锁创建
+			m_threads.emplace_back(new Thread(std::bind(&OffloadPool::run, this), m_name + "_" + std::to_string(m_submitted)));
+			if(debug) std::cout << "OffloadPool::submit() spawns thread, total = " << m_threads.size() << std::endl;
+		}
+		exited.swap(m_exited);
+	}
+	m_cond.notify_one();
+
+	// 回收因空闲退出的线程
+	for(auto& i : exited)
+	{
+		i->join();
+	}
+}
+
+void OffloadPool::setMaxThreads(size_t v)
+{
+	assert(v > 0);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_maxThreads = v;
+}
+
+size_t OffloadPool::getMaxThreads()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_maxThreads;
+}
+
+OffloadPool::Stats OffloadPool::getStats()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Stats stats;
+	stats.threads   = m_threads.size();
+	stats.idle      = m_idleCount;
+	stats.queued    = m_jobs.size();
+	stats.maxQueued = m_maxQueued;
+	stats.submitted = m_submitted;
+	stats.completed = m_completed;
+	return stats;
+}
+
+void OffloadPool::run()
+{
+	t_is_offload_thread = true;
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while(true)
+	{
+		if(m_jobs.empty())
+		{
+			if(m_stopping)
+			{
+				break;
+			}
+
+			m_idleCount++;
+			bool woken = m_cond.wait_for(lock, std::chrono::milliseconds(m_idleTimeout), [this](){
+				return !m_jobs.empty() || m_stopping;
+			});
+			m_idleCount--;
+
+			// 空闲超时 -> 线程退出
+			if(!woken)
+			{
+				break;
+			}
+			continue;
+		}
+
+		Callback job;
+		job.swap(m_jobs.front());
+		m_jobs.pop_front();
+
+		lock.unlock();
+		job();
+		job = nullptr;   // 在锁外析构捕获的对象
+		m_completed++;
+		lock.lock();
+	}
+
+	// 非关闭导致的退出 -> 移入待回收列表，由下一次submit()或析构函数join
+	if(!m_stopping)
+	{
+		Thread* self = Thread::GetThis();
+		for(auto it = m_threads.begin(); it != m_threads.end(); ++it)
+		{
+			if(it->get() == self)
+			{
+				m_exited.splice(m_exited.end(), m_threads, it);
+				break;
+			}
+		}
+	}
+	if(debug) std::cout << "OffloadPool::run() exits in thread: " << Thread::GetThreadId() << std::endl;
+}
+
+}
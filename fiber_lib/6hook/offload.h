@@ -0,0 +1,141 @@
+#ifndef _OFFLOAD_H_
+#define _OFFLOAD_H_
+
+#include <deque>
+#include <string>
+#include <cassert>
+#include <list>
+#include <memory>
+#include <atomic>
+#include <optional>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+#include <mutex>
+
+#include "thread.h"
+#include "inplace_function.h"
+
+namespace sylar {
+
+// 阻塞调用卸载池：由普通线程组成的弹性线程池，用于执行hook覆盖不到的阻塞函数（压缩、加密、第三方客户端库等）
+// 线程按需创建，空闲超过m_idleTimeout后自动退出，线程数不超过m_maxThreads
+class OffloadPool
+{
+public:
+	struct Stats
+	{
+		// 当前线程数
+		size_t threads = 0;
+		// 空闲线程数
+		size_t idle = 0;
+		// 当前排队的任务数
+		size_t queued = 0;
+		// 历史最大排队任务数
+		size_t maxQueued = 0;
+		// 已提交的任务数
+		uint64_t submitted = 0;
+		// 已完成的任务数
+		uint64_t completed = 0;
+	};
+
+	OffloadPool(size_t max_threads = 16, uint64_t idle_timeout_ms = 10000, const std::string& name = "offload");
+	~OffloadPool();
+
+	// 添加任务到队列，必要时创建新线程；任务只需可移动
+	void submit(Callback job);
+
+	void setMaxThreads(size_t v);
+	size_t getMaxThreads();
+
+	Stats getStats();
+
+public:
+	// 全局卸载池
+	static OffloadPool* GetInstance();
+	// 当前线程是否为卸载线程
+	static bool IsOffloadThread();
+
+private:
+	// 线程函数
+	void run();
+
+private:
+	std::string m_name;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	// 任务队列
+	std::deque<Callback> m_jobs;
+	// 工作线程
+	std::list<std::shared_ptr<Thread>> m_threads;
+	// 已经因空闲退出、等待回收的线程
+	std::list<std::shared_ptr<Thread>> m_exited;
+	size_t m_maxThreads;
+	uint64_t m_idleTimeout;
+	size_t m_idleCount = 0;
+	size_t m_maxQueued = 0;
+	uint64_t m_submitted = 0;
+	std::atomic<uint64_t> m_completed = {0};
+	bool m_stopping = false;
+};
+
+// 保存卸载任务的返回值或异常
+template<class R>
+struct OffloadResult
+{
+	std::optional<R> value;
+	std::exception_ptr error;
+
+	template<class F>
+	void run(F& fn)
+	{
+		try
+		{
+			value.emplace(fn());
+		}
+		catch(...)
+		{
+			error = std::current_exception();
+		}
+	}
+
+	R get()
+	{
+		if(error)
+		{
+			std::rethrow_exception(error);
+		}
+		return std::move(*value);
+	}
+};
+
+template<>
+struct OffloadResult<void>
+{
+	std::exception_ptr error;
+
+	template<class F>
+	void run(F& fn)
+	{
+		try
+		{
+			fn();
+		}
+		catch(...)
+		{
+			error = std::current_exception();
+		}
+	}
+
+	void get()
+	{
+		if(error)
+		{
+			std::rethrow_exception(error);
+		}
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef _REF_PTR_H_
+#define _REF_PTR_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace sylar {
+
+// 侵入式引用计数：计数放在对象内部，T继承RefCounted<T>
+// 与shared_ptr相比：没有单独的控制块；从裸指针（如当前协程）得到强引用只是一次fetch_add，
+// 而shared_from_this()要先从weak_ptr加锁（compare_exchange循环）
+template<class T>
+class RefCounted
+{
+public:
+	RefCounted() {}
+	RefCounted(const RefCounted&) = delete;
+	RefCounted& operator=(const RefCounted&) = delete;
+
+	void addRef() const
+	{
+		m_refCount.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// 最后一个引用释放时销毁对象
+	void release() const
+	{
+		if(m_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			delete static_cast<const T*>(this);
+		}
+	}
+
+	// acquire：读到1时，其他线程释放引用之前对对象的访问都已可见，可以安全地重用对象
+	uint32_t refCount() const {return m_refCount.load(std::memory_order_acquire);}
+
+protected:
+	~RefCounted() {}
+
+private:
+	mutable std::atomic<uint32_t> m_refCount{0};
+};
+
+// RefCounted对象的智能指针，接口与shared_ptr的常用部分一致
+template<class T>
+class RefPtr
+{
+public:
+	RefPtr() {}
+	RefPtr(std::nullptr_t) {}
+
+	// 从裸指针构造总是增加引用计数 -> 可以在任何时候从this或Fiber::Current()得到强引用
+	explicit RefPtr(T* p): m_ptr(p)
+	{
+		if(m_ptr)
+		{
+			m_ptr->addRef();
+		}
+	}
+
+	RefPtr(const RefPtr& rhs): RefPtr(rhs.m_ptr) {}
+
+	RefPtr(RefPtr&& rhs) noexcept: m_ptr(rhs.m_ptr)
+	{
+		rhs.m_ptr = nullptr;
+	}
+
+	~RefPtr()
+	{
+		if(m_ptr)
+		{
+			m_ptr->release();
+		}
+	}
+
+	RefPtr& operator=(const RefPtr& rhs)
+	{
+		RefPtr(rhs).swap(*this);
+		return *this;
+	}
+
+	RefPtr& operator=(RefPtr&& rhs) noexcept
+	{
+		RefPtr(std::move(rhs)).swap(*this);
+		return *this;
+	}
+
+	RefPtr& operator=(std::nullptr_t)
+	{
+		reset();
+		return *this;
+	}
+
+	void reset()
+	{
+		RefPtr().swap(*this);
+	}
+
+	void reset(T* p)
+	{
+		RefPtr(p).swap(*this);
+	}
+
+	void swap(RefPtr& rhs) noexcept
+	{
+		std::swap(m_ptr, rhs.m_ptr);
+	}
+
+	T* get() const {return m_ptr;}
+	T& operator*() const {return *m_ptr;}
+	T* operator->() const {return m_ptr;}
+	explicit operator bool() const {return m_ptr != nullptr;}
+
+	long use_count() const {return m_ptr ? m_ptr->refCount() : 0;}
+
+	friend bool operator==(const RefPtr& a, const RefPtr& b) {return a.m_ptr == b.m_ptr;}
+	friend bool operator!=(const RefPtr& a, const RefPtr& b) {return a.m_ptr != b.m_ptr;}
+	friend bool operator==(const RefPtr& a, std::nullptr_t) {return !a.m_ptr;}
+	friend bool operator!=(const RefPtr& a, std::nullptr_t) {return a.m_ptr != nullptr;}
+
+private:
+	T* m_ptr = nullptr;
+};
+
+}
+
+#endif
@@ -16,6 +16,18 @@ void Scheduler::SetThis()
 	t_scheduler = this;
 }
 
+// 任务开始执行：记录排队延迟，由IO事件触发的任务还记录事件到恢复执行的延迟
+static void RecordTaskStart(uint64_t enqueued, uint64_t event_ticks)
+{
+	uint64_t now = Fiber::Ticks();
+	Metrics::Inc(Metrics::TASKS_EXECUTED);
+	Metrics::Record(Metrics::QUEUE_WAIT, now - enqueued);
+	if(event_ticks)
+	{
+		Metrics::Record(Metrics::EVENT_TO_RESUME, now - event_ticks);
+	}
+}
+
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name):
 m_useCaller(use_caller), m_name(name)
 {
@@ -31,7 +43,7 @@ m_useCaller(use_caller), m_name(name)
 		threads --;  //工作线程数量
 
 		// 创建主协程，当前协程为主协程
-		Fiber::GetThis();
+		Fiber::Current();
 
 		// 创建调度协程
 		m_schedulerFiber.reset(new Fiber(std::bind(&Scheduler::run, this), 0, false)); // false -> 该调度协程退出后将返回主协程
@@ -76,6 +88,8 @@ void Scheduler::start()
 
 void Scheduler::run()  //理解见我的记录文档
 {
+	// 统计中与任务区分开（未开启SYLAR_FIBER_STATS时为空操作）
+	Fiber::SetTaskName("sylar::Scheduler::run");
 	int thread_id = Thread::GetThreadId();
 	if(debug) std::cout << "Schedule::run() starts in thread: " << thread_id << std::endl;
 	
@@ -87,11 +101,13 @@ void Scheduler::run()  //理解见我的记录文档
 	if(thread_id != m_rootThread)
 	{
 		// 创建子线程的主协程
-		Fiber::GetThis();
+		Fiber::Current();
 	}
 
-	std::shared_ptr<Fiber> idle_fiber = std::make_shared<Fiber>(std::bind(&Scheduler::idle, this));
+	RefPtr<Fiber> idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
 	ScheduleTask task;
+	// 执行回调任务的协程，结束后没有其他引用时重用（包括其栈）
+	RefPtr<Fiber> cb_fiber;
 	
 	while(true)
 	{
@@ -113,7 +129,7 @@ void Scheduler::run()  //理解见我的记录文档
 
 				// 2 取出任务
 				assert(it->fiber||it->cb);
-				task = *it;
+				task = std::move(*it);
 				m_tasks.erase(it); 
 				m_activeThreadCount++;
 				break;
@@ -129,22 +145,51 @@ void Scheduler::run()  //理解见我的记录文档
 		// 3 执行任务
 		if(task.fiber)    //指向一个已经存在的协程对象
 		{
-			{					
-				std::lock_guard<std::mutex> lock(task.fiber->m_mutex);
+			// 协程被唤醒时可能还没有在其他线程上完成yield -> 留下待唤醒标记，由那个线程释放运行权时重新调度
+			if(task.fiber->ownOrDefer())
+			{
 				if(task.fiber->getState()!=Fiber::TERM)
 				{
+					RecordTaskStart(task.enqueued, task.eventTicks);
 					task.fiber->resume();	
 				}
+				// 任务协程可能通过switchTo()切换到了其他协程
+				Fiber::ReleaseSwitched();
+				if(task.fiber->disown())
+				{
+					scheduleLock(std::move(task.fiber));
+				}
 			}
 			m_activeThreadCount--;
 			task.reset();
 		}
-		else if(task.cb)  //回调函数，需要创建一个新的协程对象
+		else if(task.cb)  //回调函数，需要一个协程对象来执行
 		{
-			std::shared_ptr<Fiber> cb_fiber = std::make_shared<Fiber>(task.cb);  // 创建一个新的协程，执行任务
+			// 上一个回调已经执行完毕 -> 重用协程；否则它仍挂起等待（被等待者引用），创建一个新的协程
+			if(cb_fiber && cb_fiber->getState() == Fiber::TERM && cb_fiber.use_count() == 1)
+			{
+				// 计数为1：其他线程已释放引用（refCount()的acquire与它们释放时的fetch_sub同步）
+				// 先取得运行权再重置 -> 确认没有线程仍持有它
+				bool owned = cb_fiber->tryOwn();
+				assert(owned);
+				(void)owned;
+				cb_fiber->reset(std::move(task.cb));
+			}
+			else
+			{
+				cb_fiber.reset(new Fiber(std::move(task.cb)));  // 创建一个新的协程，执行任务
+				// 新建的协程没有其他引用 -> 一定能取得运行权
+				cb_fiber->tryOwn();
+			}
+#ifdef SYLAR_FIBER_STATS
+			cb_fiber->setEnqueueTicks(task.enqueued);
+#endif
+			RecordTaskStart(task.enqueued, task.eventTicks);
+			cb_fiber->resume();			
+			Fiber::ReleaseSwitched();
+			if(cb_fiber->disown())
 			{
-				std::lock_guard<std::mutex> lock(cb_fiber->m_mutex);
-				cb_fiber->resume();			
+				scheduleLock(cb_fiber);
 			}
 			m_activeThreadCount--;
 			task.reset();	
@@ -216,24 +261,45 @@ void Scheduler::stop()
 	if(debug) std::cout << "Schedule::stop() ends in thread:" << Thread::GetThreadId() << std::endl;
 }
 
+bool Scheduler::takeTask(Fiber* f)
+{
+	int thread_id = Thread::GetThreadId();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	// 刚刚放入 -> 通常在队尾附近
+	for(auto it = m_tasks.rbegin(); it != m_tasks.rend(); it++)
+	{
+		if(it->fiber.get() == f)
+		{
+			if(it->thread != -1 && it->thread != thread_id)
+			{
+				return false;
+			}
+			m_tasks.erase(std::next(it).base());
+			return true;
+		}
+	}
+	return false;
+}
+
 void Scheduler::tickle()
 {
 }
 
 void Scheduler::idle()
 {
+	Fiber::SetTaskName("sylar::Scheduler::idle");
 	while(!stopping())
 	{
 		if(debug) std::cout << "Scheduler::idle(), sleeping in thread: " << Thread::GetThreadId() << std::endl;	
 		sleep(1);	
-		Fiber::GetThis()->yield(); //让出CPU资源，等待下一次调度
+		Fiber::Current()->yield(); //让出CPU资源，等待下一次调度
 	}
 }
 
 bool Scheduler::stopping() //调度器是否应该停止
 {
     std::lock_guard<std::mutex> lock(m_mutex);
-    return m_stopping && m_tasks.empty() && m_activeThreadCount == 0;
+    return m_stopping && m_tasks.empty() && m_activeThreadCount == 0 && m_pendingOffloadCount == 0;
 }
 
 }
\ No newline at end of file
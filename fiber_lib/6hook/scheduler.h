@@ -4,6 +4,10 @@
 #include "hook.h"
 #include "fiber.h"
 #include "thread.h"
+#include "offload.h"
+#include "inplace_function.h"
+#include "metrics.h"
+#include "trace.h"
 
 #include <mutex>
 #include <vector>
@@ -28,8 +32,9 @@ protected:
 	
 public:	
 	// 添加任务到任务队列
+	// event_ticks：由IO事件触发时为epoll_wait返回的时刻，用于统计事件到恢复执行的延迟
     template <class FiberOrCb>
-    void scheduleLock(FiberOrCb fc, int thread = -1) 
+    void scheduleLock(FiberOrCb fc, int thread = -1, uint64_t event_ticks = 0) 
     {
     	bool need_tickle;
     	{
@@ -37,10 +42,15 @@ public:
     		// empty ->  all thread is idle -> need to be waken up
     		need_tickle = m_tasks.empty();
 	        
-	        ScheduleTask task(fc, thread);
+	        ScheduleTask task(std::move(fc), thread);
 	        if (task.fiber || task.cb) 
 	        {
-	            m_tasks.push_back(task);
+	        	task.eventTicks = event_ticks;
+	        	if(Tracer::Enabled() && task.fiber && Tracer::Sampled(task.fiber->getId()))
+	        	{
+	        		Tracer::Record(Tracer::SCHEDULE, task.fiber->getId(), (uint64_t)(int64_t)thread);
+	        	}
+	            m_tasks.push_back(std::move(task));
 	        }
     	}
     	
@@ -49,6 +59,33 @@ public:
     		tickle();
     	}
     }
+
+	// 从任务队列中取回协程f（可以在本线程运行的），由调用者直接运行；已被其他线程取走时返回false
+	bool takeTask(Fiber* f);
+
+	// 在卸载池中执行阻塞函数fn（可以只能移动），当前协程挂起，fn完成后重新调度回本调度器，返回fn的结果或重新抛出其异常
+	// 不在任务协程中（未启用hook）或已经在卸载线程上时直接执行fn
+	template <class F>
+	auto offload(F fn) -> decltype(fn())
+	{
+		using R = decltype(fn());
+		if(!is_hook_enable() || OffloadPool::IsOffloadThread())
+		{
+			return fn();
+		}
+
+		std::shared_ptr<OffloadResult<R>> result = std::make_shared<OffloadResult<R>>();
+		RefPtr<Fiber> fiber = Fiber::GetThis();
+		m_pendingOffloadCount++;
+		OffloadPool::GetInstance()->submit([this, result, fiber, fn = std::move(fn)]() mutable {
+			result->run(fn);
+			scheduleLock(fiber);
+			m_pendingOffloadCount--;
+		});
+		// 等待卸载线程执行完毕后重新调度
+		fiber->yield();
+		return result->get();
+	}
 	
 	// 启动线程池
 	virtual void start();
@@ -70,12 +107,16 @@ protected:
 	bool hasIdleThreads() {return m_idleThreadCount>0;}
 
 private:
-	// 任务
+	// 任务：只能移动，入队和出队都不会拷贝回调
 	struct ScheduleTask
 	{
-		std::shared_ptr<Fiber> fiber;
-		std::function<void()> cb;
+		RefPtr<Fiber> fiber;
+		Callback cb;
 		int thread; // 指定任务需要运行的线程id
+		// 入队时刻（Fiber::Ticks()），用于统计排队延迟
+		uint64_t enqueued = 0;
+		// 由IO事件触发时epoll_wait返回的时刻，否则为0
+		uint64_t eventTicks = 0;
 
 		ScheduleTask()
 		{
@@ -84,28 +125,40 @@ private:
 			thread = -1;
 		}
 
-		ScheduleTask(std::shared_ptr<Fiber> f, int thr)
+		ScheduleTask(RefPtr<Fiber> f, int thr)
 		{
-			fiber = f;
+			fiber = std::move(f);
 			thread = thr;
+			enqueued = Fiber::Ticks();
+			if(fiber)
+			{
+				fiber->markRunnable();
+			}
 		}
 
-		ScheduleTask(std::shared_ptr<Fiber>* f, int thr)
+		ScheduleTask(RefPtr<Fiber>* f, int thr)
 		{
 			fiber.swap(*f);
 			thread = thr;
+			enqueued = Fiber::Ticks();
+			if(fiber)
+			{
+				fiber->markRunnable();
+			}
 		}	
 
-		ScheduleTask(std::function<void()> f, int thr)
+		ScheduleTask(Callback f, int thr)
 		{
-			cb = f;
+			cb = std::move(f);
 			thread = thr;
+			enqueued = Fiber::Ticks();
 		}		
 
-		ScheduleTask(std::function<void()>* f, int thr)
+		ScheduleTask(Callback* f, int thr)
 		{
 			cb.swap(*f);
 			thread = thr;
+			enqueued = Fiber::Ticks();
 		}
 
 		void reset()
@@ -113,6 +166,7 @@ private:
 			fiber = nullptr;
 			cb = nullptr;
 			thread = -1;
+			eventTicks = 0;
 		}	
 	};
 
@@ -132,11 +186,13 @@ private:
 	std::atomic<size_t> m_activeThreadCount = {0};
 	// 空闲线程数
 	std::atomic<size_t> m_idleThreadCount = {0};
+	// 正在卸载池中执行、等待重新调度的协程数
+	std::atomic<size_t> m_pendingOffloadCount = {0};
 
 	// 主线程是否用作工作线程
 	bool m_useCaller;
 	// 如果是 -> 需要额外创建调度协程，用于在主线程中执行调度任务
-	std::shared_ptr<Fiber> m_schedulerFiber;
+	RefPtr<Fiber> m_schedulerFiber;
 	// 如果是 -> 记录主线程的线程id
 	int m_rootThread = -1;
 	// 调度器是否正在关闭
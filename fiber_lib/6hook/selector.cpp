@@ -0,0 +1,202 @@
+#include "selector.h"
+
+#include <algorithm>
+#include <iostream>
+#include <cassert>
+#include <cstring>
+
+static bool debug = false;
+
+namespace sylar {
+
+int Selector::addIo(int fd, IOManager::Event event)
+{
+	int idx = m_cases.size();
+	Case* c = new Case(idx);
+	c->fd = fd;
+	c->event = event;
+	m_cases.emplace_back(c);
+	return idx;
+}
+
+int Selector::armChannels(SelectState* state, FiberWaiter*& peer)
+{
+	// 按地址顺序锁住所有通道，避免与其他Selector死锁
+	// 持锁期间其他协程无法取走本Selector的分支，也还没有注册fd事件和定时器 -> state只由当前协程修改
+	std::vector<std::mutex*> locks;
+	for(auto& c : m_cases)
+	{
+		c->bind(state);
+		if(c->mutex())
+		{
+			locks.push_back(c->mutex());
+		}
+	}
+	std::sort(locks.begin(), locks.end());
+	locks.erase(std::unique(locks.begin(), locks.end()), locks.end());
+	for(std::mutex* m : locks)
+	{
+		m->lock();
+	}
+
+	int fired = SelectState::NONE;
+	for(auto& c : m_cases)
+	{
+		if(c->mutex() && c->tryComplete(peer))
+		{
+			fired = c->index;
+			break;
+		}
+	}
+	if(fired == SelectState::NONE)
+	{
+		for(auto& c : m_cases)
+		{
+			c->enqueue();
+		}
+	}
+	else
+	{
+		state->fired = fired;
+	}
+
+	for(auto it = locks.rbegin(); it != locks.rend(); ++it)
+	{
+		(*it)->unlock();
+	}
+	return fired;
+}
+
+void Selector::park(std::shared_ptr<SelectState> state, IOManager* iom)
+{
+	FiberWaiter& waiter = state->waiter;
+	if(m_timeout == ~0ull)
+	{
+		waiter.park();
+		return;
+	}
+
+	if(!waiter.fiber)
+	{
+		if(waiter.sem->waitFor(m_timeout))
+		{
+			return;
+		}
+		int expected = SelectState::NONE;
+		if(state->fired.compare_exchange_strong(expected, TIMEOUT))
+		{
+			return;
+		}
+		// 超时的同时被某个分支唤醒 -> 消耗掉这次signal
+		waiter.sem->wait();
+		return;
+	}
+
+	if(!iom)
+	{
+		waiter.park();
+		return;
+	}
+
+	std::shared_ptr<Timer> timer = iom->addTimer(m_timeout, [state]()
+	{
+		int expected = SelectState::NONE;
+		if(state->fired.compare_exchange_strong(expected, TIMEOUT))
+		{
+			state->waiter.wake();
+		}
+	});
+	waiter.park();
+	timer->cancel();
+}
+
+int Selector::wait()
+{
+	assert(!m_waited);
+	m_waited = true;
+
+	std::shared_ptr<SelectState> state = std::make_shared<SelectState>();
+	IOManager* iom = dynamic_cast<IOManager*>(state->waiter.scheduler);
+
+	// 1 通道分支：能立即完成就不挂起
+	FiberWaiter* peer = nullptr;
+	int fired = armChannels(state.get(), peer);
+	if(fired != SelectState::NONE)
+	{
+		if(peer)
+		{
+			peer->wake();
+		}
+		m_ok = m_cases[fired]->ok();
+		return fired;
+	}
+
+	// 2 fd分支：回调中claim成功才唤醒协程，回调持有state，Selector返回后仍然有效
+	// 自己claim成功（注册失败）时不需要挂起
+	bool self = false;
+	std::vector<Case*> armed;
+	for(auto& c : m_cases)
+	{
+		if(c->mutex())
+		{
+			continue;
+		}
+		assert(iom);
+		if(state->fired.load() != SelectState::NONE)
+		{
+			break;
+		}
+		int idx = c->index;
+		int rt = iom->addEvent(c->fd, c->event, [state, idx]()
+		{
+			int expected = SelectState::NONE;
+			if(state->fired.compare_exchange_strong(expected, idx))
+			{
+				state->waiter.wake();
+			}
+		});
+		if(rt)
+		{
+			if(debug) std::cout << "Selector::wait() addEvent failed fd=" << c->fd << std::endl;
+			int expected = SelectState::NONE;
+			if(state->fired.compare_exchange_strong(expected, ERROR))
+			{
+				self = true;
+			}
+			break;
+		}
+		armed.push_back(c.get());
+	}
+
+	// 3 挂起，恰好有一个分支（或超时定时器）会唤醒
+	if(!self)
+	{
+		park(state, iom);
+	}
+	fired = state->fired.load();
+
+	// 4 撤销其余分支：delEvent不触发回调，已经触发的事件其EventContext已被清空
+	for(Case* c : armed)
+	{
+		if(c->index != fired)
+		{
+			iom->delEvent(c->fd, c->event);
+		}
+	}
+	for(auto& c : m_cases)
+	{
+		if(c->mutex())
+		{
+			c->cancel();
+		}
+	}
+
+	if(fired == ERROR)
+	{
+		errno = EEXIST;
+	}
+	m_ok = fired >= 0 && m_cases[fired]->ok();
+	return fired;
+}
+
+}
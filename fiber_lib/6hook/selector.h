@@ -0,0 +1,170 @@
+#ifndef _SELECTOR_H_
+#define _SELECTOR_H_
+
+#include <vector>
+#include <memory>
+
+#include "channel.h"
+#include "ioscheduler.h"
+
+namespace sylar {
+
+// 多路等待：同时等待多个fd事件、通道操作和一个超时，第一个就绪的分支唤醒协程，其余分支随即撤销
+// 撤销fd事件使用IOManager::delEvent，不会留下残留的EventContext；撤销通道分支时从等待队列中删除
+// 每个Selector只能wait()一次
+//
+// Selector sel;
+// int r = sel.onRead(client_fd);
+// int u = sel.onRecv(upstream, msg);
+// sel.setTimeout(3000);
+// int i = sel.wait();
+class Selector
+{
+public:
+	// wait()的特殊返回值
+	static const int TIMEOUT = -2;
+	// 注册fd事件失败（如该fd的同一事件已被其他协程等待），errno为EEXIST
+	static const int ERROR = -3;
+
+	Selector() {}
+	Selector(const Selector&) = delete;
+	Selector& operator=(const Selector&) = delete;
+
+	// 以下函数添加一个分支，返回分支编号（按添加顺序从0开始）
+	// fd可读/可写，只能在IOManager的协程中使用
+	int onRead(int fd) {return addIo(fd, IOManager::READ);}
+	int onWrite(int fd) {return addIo(fd, IOManager::WRITE);}
+
+	// 从通道接收到value
+	template<class T>
+	int onRecv(Channel<T>& ch, T& value)
+	{
+		int idx = m_cases.size();
+		m_cases.emplace_back(new RecvCase<T>(ch, value, idx));
+		return idx;
+	}
+
+	// 向通道发送value
+	template<class T>
+	int onSend(Channel<T>& ch, T value)
+	{
+		int idx = m_cases.size();
+		m_cases.emplace_back(new SendCase<T>(ch, std::move(value), idx));
+		return idx;
+	}
+
+	// 超时时间，不设置则一直等待
+	void setTimeout(uint64_t ms) {m_timeout = ms;}
+
+	// 挂起直到某个分支就绪，返回其编号；超时返回TIMEOUT
+	// 多个通道分支可以立即完成时选择最先添加的
+	int wait();
+
+	// 就绪的通道分支是否成功传递了数据，false表示通道已关闭
+	bool ok() const {return m_ok;}
+
+private:
+	// 一个分支
+	// 通道分支的tryComplete/enqueue在持有通道锁时调用，cancel自己加锁
+	struct Case
+	{
+		explicit Case(int idx): index(idx) {}
+		virtual ~Case() {}
+
+		// fd分支返回nullptr
+		virtual std::mutex* mutex() {return nullptr;}
+		virtual void bind(SelectState*) {}
+		// 能立即完成时完成并返回true，需要唤醒的对端由peer返回
+		virtual bool tryComplete(FiberWaiter*&) {return false;}
+		virtual void enqueue() {}
+		virtual void cancel() {}
+		// 通道分支被对端唤醒后的结果
+		virtual bool ok() {return true;}
+
+		int index;
+		// fd分支
+		int fd = -1;
+		IOManager::Event event = IOManager::NONE;
+	};
+
+	template<class T>
+	struct RecvCase : public Case
+	{
+		RecvCase(Channel<T>& c, T& v, int idx): Case(idx), ch(c), value(v) {}
+
+		std::mutex* mutex() override {return &ch.m_mutex;}
+		void bind(SelectState* state) override
+		{
+			waiter.reset(new typename Channel<T>::Waiter(state, index));
+			waiter->slot = &value;
+		}
+		bool tryComplete(FiberWaiter*& peer) override
+		{
+			typename Channel<T>::Waiter* p = nullptr;
+			typename Channel<T>::Status st = ch.recvLocked(value, p);
+			peer = p;
+			waiter->ok = st == Channel<T>::OK;
+			return st != Channel<T>::WOULD_BLOCK;
+		}
+		void enqueue() override {ch.m_recvWaiters.push_back(waiter.get());}
+		void cancel() override
+		{
+			std::lock_guard<std::mutex> lock(ch.m_mutex);
+			ch.m_recvWaiters.remove(waiter.get());
+		}
+		bool ok() override {return waiter->ok;}
+
+		Channel<T>& ch;
+		T& value;
+		std::unique_ptr<typename Channel<T>::Waiter> waiter;
+	};
+
+	template<class T>
+	struct SendCase : public Case
+	{
+		SendCase(Channel<T>& c, T&& v, int idx): Case(idx), ch(c), value(std::move(v)) {}
+
+		std::mutex* mutex() override {return &ch.m_mutex;}
+		void bind(SelectState* state) override
+		{
+			waiter.reset(new typename Channel<T>::Waiter(state, index));
+			waiter->slot = &value;
+		}
+		bool tryComplete(FiberWaiter*& peer) override
+		{
+			typename Channel<T>::Waiter* p = nullptr;
+			typename Channel<T>::Status st = ch.sendLocked(value, p);
+			peer = p;
+			waiter->ok = st == Channel<T>::OK;
+			return st != Channel<T>::WOULD_BLOCK;
+		}
+		void enqueue() override {ch.m_sendWaiters.push_back(waiter.get());}
+		void cancel() override
+		{
+			std::lock_guard<std::mutex> lock(ch.m_mutex);
+			ch.m_sendWaiters.remove(waiter.get());
+		}
+		bool ok() override {return waiter->ok;}
+
+		Channel<T>& ch;
+		T value;
+		std::unique_ptr<typename Channel<T>::Waiter> waiter;
+	};
+
+	int addIo(int fd, IOManager::Event event);
+
+	// 持有所有通道锁时尝试立即完成，都不能完成时把分支加入各通道的等待队列
+	int armChannels(SelectState* state, FiberWaiter*& peer);
+	// 挂起直到被唤醒或超时
+	void park(std::shared_ptr<SelectState> state, IOManager* iom);
+
+private:
+	std::vector<std::unique_ptr<Case>> m_cases;
+	uint64_t m_timeout = ~0ull;
+	bool m_ok = false;
+	bool m_waited = false;
+};
+
+}
+
+#endif
@@ -0,0 +1,463 @@
+#ifndef _TASK_H_
+#define _TASK_H_
+
+// C++20无栈协程：需要以 -std=c++20 编译，C++17下本文件为空，其余代码不受影响
+#if defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <exception>
+#include <type_traits>
+#include <cstdlib>
+
+#include "ioscheduler.h"
+#include "channel.h"
+#include "future.h"
+
+namespace sylar {
+
+// 无栈协程Task<T>：协程帧只保存跨越co_await的局部变量（通常几百字节），不需要独立的协程栈
+// 在Scheduler的任务（回调协程）中运行，co_await挂起时回调协程结束并被复用，恢复时再由调度器调度
+// 可以co_await：另一个Task、IOManager的fd事件（io_ready）、定时器（sleep_for）、Channel、spawn()返回的Future
+// 由co_spawn()启动，返回的Future可以在有栈协程中get()等待 -> 两种协程可以互相等待
+//
+// sylar::Task<int> echo(int fd)
+// {
+//     co_await sylar::io_ready(fd, sylar::IOManager::READ);
+//     ...
+//     co_return n;
+// }
+// sylar::co_spawn(iom, echo(fd));
+
+// 协程帧的缓存：按64字节分级的线程局部空闲链表，帧在哪个线程释放就放回哪个线程的链表
+class TaskFramePool
+{
+public:
+	static void* Allocate(size_t size)
+	{
+		size_t cls = (size + ALIGN - 1) / ALIGN;
+		if(cls >= CLASSES)
+		{
+			return ::operator new(size);
+		}
+		Cache& cache = GetCache();
+		if(FreeNode* node = cache.head[cls])
+		{
+			cache.head[cls] = node->next;
+			cache.count[cls]--;
+			return node;
+		}
+		return ::operator new(cls * ALIGN);
+	}
+
+	static void Deallocate(void* p, size_t size)
+	{
+		size_t cls = (size + ALIGN - 1) / ALIGN;
+		if(cls >= CLASSES)
+		{
+			::operator delete(p);
+			return;
+		}
+		Cache& cache = GetCache();
+		if(cache.count[cls] >= MAX_CACHED)
+		{
+			::operator delete(p);
+			return;
+		}
+		FreeNode* node = (FreeNode*)p;
+		node->next = cache.head[cls];
+		cache.head[cls] = node;
+		cache.count[cls]++;
+	}
+
+private:
+	static const size_t ALIGN = 64;
+	// 最大缓存2KB以内的帧
+	static const size_t CLASSES = 32;
+	// 每一级每个线程最多缓存的帧数
+	static const size_t MAX_CACHED = 256;
+
+	struct FreeNode
+	{
+		FreeNode* next;
+	};
+
+	struct Cache
+	{
+		FreeNode* head[CLASSES] = {};
+		size_t count[CLASSES] = {};
+
+		~Cache()
+		{
+			for(size_t i = 0; i < CLASSES; i++)
+			{
+				while(FreeNode* node = head[i])
+				{
+					head[i] = node->next;
+					::operator delete(node);
+				}
+			}
+		}
+	};
+
+	static Cache& GetCache()
+	{
+		static thread_local Cache t_cache;
+		return t_cache;
+	}
+};
+
+template<class T>
+class Task;
+
+// promise中与结果类型无关的部分
+struct TaskPromiseBase
+{
+	// 等待本协程完成的协程，完成时直接切换过去（对称转移，不经过调度器）
+	std::coroutine_handle<> continuation;
+
+	struct FinalAwaiter
+	{
+		bool await_ready() noexcept {return false;}
+
+		template<class Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+		{
+			std::coroutine_handle<> c = h.promise().continuation;
+			return c ? c : std::noop_coroutine();
+		}
+
+		void await_resume() noexcept {}
+	};
+
+	// 惰性启动：直到被co_await或co_spawn才开始执行
+	std::suspend_always initial_suspend() noexcept {return {};}
+	FinalAwaiter final_suspend() noexcept {return {};}
+
+	static void* operator new(size_t size) {return TaskFramePool::Allocate(size);}
+	static void operator delete(void* p, size_t size) {TaskFramePool::Deallocate(p, size);}
+};
+
+template<class T>
+struct TaskPromise : public TaskPromiseBase
+{
+	OffloadResult<T> result;
+
+	template<class U>
+	void return_value(U&& value) {result.value.emplace(std::forward<U>(value));}
+	void unhandled_exception() {result.error = std::current_exception();}
+};
+
+template<>
+struct TaskPromise<void> : public TaskPromiseBase
+{
+	OffloadResult<void> result;
+
+	void return_void() {}
+	void unhandled_exception() {result.error = std::current_exception();}
+};
+
+template<class T = void>
+class Task
+{
+public:
+	struct promise_type : public TaskPromise<T>
+	{
+		Task get_return_object() {return Task(std::coroutine_handle<promise_type>::from_promise(*this));}
+	};
+
+	Task() {}
+	explicit Task(std::coroutine_handle<promise_type> h): m_handle(h) {}
+	Task(Task&& rhs): m_handle(rhs.m_handle) {rhs.m_handle = nullptr;}
+	Task& operator=(Task&& rhs)
+	{
+		if(this != &rhs)
+		{
+			reset();
+			m_handle = rhs.m_handle;
+			rhs.m_handle = nullptr;
+		}
+		return *this;
+	}
+	~Task() {reset();}
+
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+
+	bool valid() const {return (bool)m_handle;}
+
+	// co_await task：启动task并挂起当前协程，task完成后恢复，返回其结果或重新抛出其异常
+	auto operator co_await() &&
+	{
+		struct Awaiter
+		{
+			std::coroutine_handle<promise_type> handle;
+
+			bool await_ready() {return false;}
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller)
+			{
+				handle.promise().continuation = caller;
+				return handle;
+			}
+			T await_resume() {return handle.promise().result.get();}
+		};
+		return Awaiter{m_handle};
+	}
+
+private:
+	void reset()
+	{
+		if(m_handle)
+		{
+			m_handle.destroy();
+			m_handle = nullptr;
+		}
+	}
+
+private:
+	std::coroutine_handle<promise_type> m_handle;
+};
+
+// co_spawn使用的顶层协程：创建后挂起，由调度器启动，结束时自动销毁协程帧
+struct DetachedTask
+{
+	struct promise_type
+	{
+		DetachedTask get_return_object() {return DetachedTask{std::coroutine_handle<promise_type>::from_promise(*this)};}
+		std::suspend_always initial_suspend() noexcept {return {};}
+		std::suspend_never final_suspend() noexcept {return {};}
+		void return_void() {}
+		void unhandled_exception() {std::terminate();}
+
+		static void* operator new(size_t size) {return TaskFramePool::Allocate(size);}
+		static void operator delete(void* p, size_t size) {TaskFramePool::Deallocate(p, size);}
+	};
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+// 在调度器中恢复协程，作为FiberWaiter的回调
+inline void ResumeCoroutine(void* address)
+{
+	std::coroutine_handle<>::from_address(address).resume();
+}
+
+template<class T>
+DetachedTask RunTask(Task<T> task, std::shared_ptr<FutureState<T>> state)
+{
+	try
+	{
+		if constexpr(std::is_void_v<T>)
+		{
+			co_await std::move(task);
+		}
+		else
+		{
+			state->result.value.emplace(co_await std::move(task));
+		}
+	}
+	catch(...)
+	{
+		state->result.error = std::current_exception();
+	}
+	state->complete();
+}
+
+// 在scheduler中启动task，返回的Future在task完成时就绪：有栈协程中get()挂起等待，Task中可以co_await
+template<class T>
+Future<T> co_spawn(Scheduler* scheduler, Task<T> task)
+{
+	assert(scheduler);
+	std::shared_ptr<FutureState<T>> state = std::make_shared<FutureState<T>>();
+	std::coroutine_handle<> h = RunTask(std::move(task), state).handle;
+	scheduler->scheduleLock([h]() {h.resume();});
+	return Future<T>(state);
+}
+
+template<class T>
+Future<T> co_spawn(Task<T> task)
+{
+	return co_spawn(Scheduler::GetThis(), std::move(task));
+}
+
+// co_await io_ready(fd, IOManager::READ)：等待fd就绪，成功返回0，添加事件失败返回-1
+// fd不需要经过hook设置为非阻塞，但之后的读写应当是非阻塞的
+class IoAwaiter
+{
+public:
+	IoAwaiter(int fd, IOManager::Event event): m_fd(fd), m_event(event) {}
+
+	bool await_ready() {return false;}
+	bool await_suspend(std::coroutine_handle<> h)
+	{
+		IOManager* iom = IOManager::GetThis();
+		if(!iom || iom->addEvent(m_fd, m_event, [h]() {h.resume();}) != 0)
+		{
+			m_result = -1;
+			return false;
+		}
+		// 事件可能已经在其他线程上触发并恢复了协程 -> 之后不能再访问成员
+		return true;
+	}
+	int await_resume() {return m_result;}
+
+private:
+	int m_fd;
+	IOManager::Event m_event;
+	int m_result = 0;
+};
+
+inline IoAwaiter io_ready(int fd, IOManager::Event event)
+{
+	return IoAwaiter(fd, event);
+}
+
+// co_await sleep_for(ms)：挂起ms毫秒，不占用线程和协程栈
+class SleepAwaiter
+{
+public:
+	explicit SleepAwaiter(uint64_t ms): m_ms(ms) {}
+
+	bool await_ready() {return m_ms == 0;}
+	bool await_suspend(std::coroutine_handle<> h)
+	{
+		IOManager* iom = IOManager::GetThis();
+		if(!iom)
+		{
+			return false;
+		}
+		iom->addTimer(m_ms, [h]() {h.resume();});
+		return true;
+	}
+	void await_resume() {}
+
+private:
+	uint64_t m_ms;
+};
+
+inline SleepAwaiter sleep_for(uint64_t ms)
+{
+	return SleepAwaiter(ms);
+}
+
+// co_await recv_from(ch, value)：通道关闭且没有剩余数据时返回false
+// co_await send_to(ch, value)：通道关闭时返回false
+// 等待者位于协程帧中，与有栈协程中的send/recv可以互相配对
+template<class T>
+class ChannelRecvAwaiter
+{
+public:
+	ChannelRecvAwaiter(Channel<T>& ch, T& value): m_channel(ch), m_value(value) {}
+
+	bool await_ready() {return false;}
+	bool await_suspend(std::coroutine_handle<> h)
+	{
+		m_waiter.emplace(Scheduler::GetThis(), &ResumeCoroutine, h.address());
+		// 入队后对端可能在其他线程上立即唤醒并恢复本协程（甚至协程已经结束、帧已释放）
+		// -> 入队时不能再写成员，之后只能通过m_waiter->ok得到结果
+		typename Channel<T>::Status st = m_channel.recvOrEnqueue(m_value, *m_waiter);
+		if(st == Channel<T>::WOULD_BLOCK)
+		{
+			return true;
+		}
+		m_status = st;
+		return false;
+	}
+	bool await_resume()
+	{
+		if(m_status == Channel<T>::WOULD_BLOCK)
+		{
+			return m_waiter->ok;
+		}
+		return m_status == Channel<T>::OK;
+	}
+
+private:
+	Channel<T>& m_channel;
+	T& m_value;
+	std::optional<typename Channel<T>::Waiter> m_waiter;
+	// 没有入队（立即完成）时为调用结果，否则保持WOULD_BLOCK
+	typename Channel<T>::Status m_status = Channel<T>::WOULD_BLOCK;
+};
+
+template<class T>
+class ChannelSendAwaiter
+{
+public:
+	ChannelSendAwaiter(Channel<T>& ch, T value): m_channel(ch), m_value(std::move(value)) {}
+
+	bool await_ready() {return false;}
+	bool await_suspend(std::coroutine_handle<> h)
+	{
+		m_waiter.emplace(Scheduler::GetThis(), &ResumeCoroutine, h.address());
+		// 入队后对端可能在其他线程上立即唤醒并恢复本协程（甚至协程已经结束、帧已释放）
+		// -> 入队时不能再写成员，之后只能通过m_waiter->ok得到结果
+		typename Channel<T>::Status st = m_channel.sendOrEnqueue(m_value, *m_waiter);
+		if(st == Channel<T>::WOULD_BLOCK)
+		{
+			return true;
+		}
+		m_status = st;
+		return false;
+	}
+	bool await_resume()
+	{
+		if(m_status == Channel<T>::WOULD_BLOCK)
+		{
+			return m_waiter->ok;
+		}
+		return m_status == Channel<T>::OK;
+	}
+
+private:
+	Channel<T>& m_channel;
+	T m_value;
+	std::optional<typename Channel<T>::Waiter> m_waiter;
+	// 没有入队（立即完成）时为调用结果，否则保持WOULD_BLOCK
+	typename Channel<T>::Status m_status = Channel<T>::WOULD_BLOCK;
+};
+
+template<class T>
+ChannelRecvAwaiter<T> recv_from(Channel<T>& ch, T& value)
+{
+	return ChannelRecvAwaiter<T>(ch, value);
+}
+
+template<class T>
+ChannelSendAwaiter<T> send_to(Channel<T>& ch, T value)
+{
+	return ChannelSendAwaiter<T>(ch, std::move(value));
+}
+
+// co_await future：等待spawn()启动的有栈协程（或co_spawn的Task）完成，返回其结果
+template<class T>
+class FutureAwaiter
+{
+public:
+	explicit FutureAwaiter(Future<T> future): m_future(std::move(future)) {}
+
+	bool await_ready() {return m_future.isReady();}
+	void await_suspend(std::coroutine_handle<> h)
+	{
+		Scheduler* scheduler = Scheduler::GetThis();
+		// 完成回调在完成者的上下文中执行 -> 放回本调度器恢复协程
+		m_future.getState()->then([scheduler, h]() {
+			scheduler->scheduleLock([h]() {h.resume();});
+		});
+	}
+	T await_resume() {return m_future.get();}
+
+private:
+	Future<T> m_future;
+};
+
+template<class T>
+FutureAwaiter<T> operator co_await(Future<T> future)
+{
+	return FutureAwaiter<T>(std::move(future));
+}
+
+}
+
+#endif
+
+#endif
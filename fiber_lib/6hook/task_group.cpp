@@ -0,0 +1,98 @@
+#include "task_group.h"
+
+#include <algorithm>
+
+namespace sylar {
+
+TaskGroup::TaskGroup(Scheduler* scheduler):
+m_scheduler(scheduler)
+{
+	assert(m_scheduler);
+
+	CancelToken* parent = CancelToken::GetThis();
+	m_token = std::make_shared<CancelToken>(parent ? parent->shared_from_this() : nullptr);
+}
+
+TaskGroup::~TaskGroup()
+{
+	wait();
+}
+
+void TaskGroup::wait()
+{
+	FiberWaiter w;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(m_running == 0)
+		{
+			return;
+		}
+		m_waiters.push_back(&w);
+	}
+	w.park();
+}
+
+void TaskGroup::memberDone()
+{
+	WaitList waiters;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		assert(m_running > 0);
+		if(--m_running != 0)
+		{
+			return;
+		}
+		while(FiberWaiter* w = m_waiters.pop_front())
+		{
+			waiters.push_back(w);
+		}
+	}
+	while(FiberWaiter* w = waiters.pop_front())
+	{
+		w->wake();
+	}
+}
+
+void TaskGroup::cancel()
+{
+	m_token->cancel();
+
+	std::vector<std::weak_ptr<Timer>> timers;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		timers.swap(m_timers);
+	}
+	for(auto& t : timers)
+	{
+		if(std::shared_ptr<Timer> timer = t.lock())
+		{
+			timer->cancel();
+		}
+	}
+}
+
+std::shared_ptr<Timer> TaskGroup::addTimer(uint64_t ms, Callback cb, bool recurring)
+{
+	IOManager* iom = dynamic_cast<IOManager*>(m_scheduler);
+	assert(iom);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(isCancelled())
+	{
+		return nullptr;
+	}
+	std::shared_ptr<Timer> timer = iom->addTimer(ms, std::move(cb), recurring);
+	// 清理已经触发的一次性定时器
+	m_timers.erase(std::remove_if(m_timers.begin(), m_timers.end(),
+		[](const std::weak_ptr<Timer>& t) {return t.expired();}), m_timers.end());
+	m_timers.push_back(timer);
+	return timer;
+}
+
+size_t TaskGroup::getRunningCount()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_running;
+}
+
+}
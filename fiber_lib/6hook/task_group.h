@@ -0,0 +1,78 @@
+#ifndef _TASK_GROUP_H_
+#define _TASK_GROUP_H_
+
+#include <vector>
+#include <memory>
+
+#include "future.h"
+#include "cancel.h"
+#include "ioscheduler.h"
+
+namespace sylar {
+
+// 结构化并发：同一组协程一起等待、一起取消
+// cancel()后，成员协程在hook的阻塞调用（read/write/connect/poll/sleep等）中被唤醒并返回ECANCELED，
+// 之后再发起的阻塞调用立即失败；组内添加的定时器也被取消
+// 在成员协程（或DeadlineScope）中创建的TaskGroup继承当前协程的令牌：父组取消或截止时间到期时本组一起取消
+// 析构时等待所有成员结束
+class TaskGroup
+{
+public:
+	explicit TaskGroup(Scheduler* scheduler = Scheduler::GetThis());
+	~TaskGroup();
+
+	TaskGroup(const TaskGroup&) = delete;
+	TaskGroup& operator=(const TaskGroup&) = delete;
+
+	// 创建成员协程执行fn
+	template<class F>
+	auto spawn(F fn) -> Future<decltype(fn())>
+	{
+		using R = decltype(fn());
+		std::shared_ptr<FutureState<R>> state = std::make_shared<FutureState<R>>();
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_running++;
+		}
+		m_scheduler->scheduleLock([this, state, fn]() mutable {
+			Fiber* fiber = Fiber::Current();
+			fiber->setCancelToken(m_token.get());
+			state->result.run(fn);
+			fiber->setCancelToken(nullptr);
+			state->complete();
+			memberDone();
+		});
+		return Future<R>(state);
+	}
+
+	// 挂起直到所有成员结束，最后一个成员结束时才唤醒
+	void wait();
+
+	// 取消所有成员，可以在任意线程调用
+	void cancel();
+	bool isCancelled() const {return m_token->isCancelled();}
+
+	// 添加属于本组的定时器，cancel()时一起取消；需要调度器是IOManager
+	std::shared_ptr<Timer> addTimer(uint64_t ms, Callback cb, bool recurring = false);
+
+	size_t getRunningCount();
+
+private:
+	void memberDone();
+
+private:
+	Scheduler* m_scheduler;
+	// 成员协程的令牌，父令牌为创建本组的协程的令牌
+	std::shared_ptr<CancelToken> m_token;
+
+	std::mutex m_mutex;
+	// 正在运行的成员数
+	size_t m_running = 0;
+	// 在wait()中等待的协程
+	WaitList m_waiters;
+	std::vector<std::weak_ptr<Timer>> m_timers;
+};
+
+}
+
+#endif
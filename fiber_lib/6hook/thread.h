@@ -4,6 +4,7 @@
 #include <mutex>
 #include <condition_variable>
 #include <functional>     
+#include <chrono>
 
 namespace sylar
 {
@@ -30,6 +31,17 @@ public:
         count--;
     }
 
+    // 带超时的P操作，超时返回false
+    bool waitFor(uint64_t ms)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (!cv.wait_for(lock, std::chrono::milliseconds(ms), [this]{ return count > 0; })) {
+            return false;
+        }
+        count--;
+        return true;
+    }
+
     // V操作
     void signal() 
     {
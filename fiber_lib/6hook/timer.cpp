@@ -1,4 +1,5 @@
 #include "timer.h"
+#include "metrics.h"
 
 namespace sylar {
 
@@ -6,13 +7,14 @@ bool Timer::cancel()
 {
     std::unique_lock<std::shared_mutex> write_lock(m_manager->m_mutex);
 
-    if(m_cb == nullptr) 
+    if(!isActive()) 
     {
         return false;
     }
     else
     {
         m_cb = nullptr;
+        m_recurringCb.reset();
     }
 
     auto it = m_manager->m_timers.find(shared_from_this());
@@ -20,6 +22,7 @@ bool Timer::cancel()
     {
         m_manager->m_timers.erase(it);
     }
+    Metrics::Inc(Metrics::TIMERS_CANCELLED);
     return true;
 }
 
@@ -28,11 +31,18 @@ bool Timer::refresh()
 {
     std::unique_lock<std::shared_mutex> write_lock(m_manager->m_mutex);
 
-    if(!m_cb) 
+    if(!isActive()) 
     {
         return false;
     }
 
+    // 循环timer的回调正在执行 -> 执行完毕后按新的时间重新加入
+    if(m_running)
+    {
+        m_next = std::chrono::system_clock::now() + std::chrono::milliseconds(m_ms);
+        return true;
+    }
+
     auto it = m_manager->m_timers.find(shared_from_this());
     if(it==m_manager->m_timers.end())
     {
@@ -55,10 +65,18 @@ bool Timer::reset(uint64_t ms, bool from_now)
     {
         std::unique_lock<std::shared_mutex> write_lock(m_manager->m_mutex);
     
-        if(!m_cb) 
+        if(!isActive()) 
         {
             return false;
         }
+
+        if(m_running)
+        {
+            auto start = from_now ? std::chrono::system_clock::now() : m_next - std::chrono::milliseconds(m_ms);
+            m_ms = ms;
+            m_next = start + std::chrono::milliseconds(m_ms);
+            return true;
+        }
         
         auto it = m_manager->m_timers.find(shared_from_this());
         if(it==m_manager->m_timers.end())
@@ -76,9 +94,18 @@ bool Timer::reset(uint64_t ms, bool from_now)
     return true;
 }
 
-Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager):
-m_recurring(recurring), m_ms(ms), m_cb(cb), m_manager(manager) 
+Timer::Timer(uint64_t ms, Callback cb, bool recurring, TimerManager* manager):
+m_recurring(recurring), m_ms(ms), m_manager(manager) 
 {
+    if(m_recurring)
+    {
+        m_recurringCb = std::make_shared<Callback>(std::move(cb));
+    }
+    else
+    {
+        m_cb = std::move(cb);
+    }
+
     auto now = std::chrono::system_clock::now();
     m_next = now + std::chrono::milliseconds(m_ms);
 }
@@ -98,28 +125,13 @@ TimerManager::~TimerManager()
 {
 }
 
-std::shared_ptr<Timer> TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring) 
+std::shared_ptr<Timer> TimerManager::addTimer(uint64_t ms, Callback cb, bool recurring) 
 {
-    std::shared_ptr<Timer> timer(new Timer(ms, cb, recurring, this));
+    std::shared_ptr<Timer> timer(new Timer(ms, std::move(cb), recurring, this));
     addTimer(timer);
     return timer;
 }
 
-// 如果条件存在 -> 执行cb()
-static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb)
-{
-    std::shared_ptr<void> tmp = weak_cond.lock();
-    if(tmp)
-    {
-        cb();
-    }
-}
-
-std::shared_ptr<Timer> TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring) 
-{
-    return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
-}
-
 uint64_t TimerManager::getNextTimer()
 {
     std::shared_lock<std::shared_mutex> read_lock(m_mutex);
@@ -148,7 +160,7 @@ uint64_t TimerManager::getNextTimer()
     }  
 }
 
-void TimerManager::listExpiredCb(std::vector<std::function<void()>>& cbs)
+void TimerManager::listExpiredCb(std::vector<Callback>& cbs)
 {
     auto now = std::chrono::system_clock::now();
 
@@ -162,19 +174,25 @@ void TimerManager::listExpiredCb(std::vector<std::function<void()>>& cbs)
         std::shared_ptr<Timer> temp = *m_timers.begin();
         m_timers.erase(m_timers.begin());
         
-        cbs.push_back(temp->m_cb); 
-
         if (temp->m_recurring)
         {
-            // 重新加入时间堆
+            // 下一次超时仍从本次超时算起，但回调返回后才重新加入时间堆 -> 回调不会在多个线程上并发执行
+            std::shared_ptr<Callback> cb = temp->m_recurringCb;
             temp->m_next = now + std::chrono::milliseconds(temp->m_ms);
-            m_timers.insert(temp);
+            temp->m_running = true;
+            cbs.push_back([temp, cb]() 
+            {
+                (*cb)();
+                temp->m_manager->rearmTimer(temp);
+            });
         }
         else
         {
-            // 清理cb
+            // 移出cb -> 同时清理
+            cbs.push_back(std::move(temp->m_cb));
             temp->m_cb = nullptr;
         }
+        Metrics::Inc(Metrics::TIMERS_FIRED);
     }
 }
 
@@ -190,14 +208,7 @@ void TimerManager::addTimer(std::shared_ptr<Timer> timer)
     bool at_front = false;
     {
         std::unique_lock<std::shared_mutex> write_lock(m_mutex);
-        auto it = m_timers.insert(timer).first;
-        at_front = (it == m_timers.begin()) && !m_tickled;
-        
-        // only tickle once till one thread wakes up and runs getNextTime()
-        if(at_front)
-        {
-            m_tickled = true;
-        }
+        at_front = insertTimer(timer);
     }
    
     if(at_front)
@@ -207,6 +218,39 @@ void TimerManager::addTimer(std::shared_ptr<Timer> timer)
     }
 }
 
+bool TimerManager::insertTimer(const std::shared_ptr<Timer>& timer)
+{
+    auto it = m_timers.insert(timer).first;
+    bool at_front = (it == m_timers.begin()) && !m_tickled;
+    
+    // only tickle once till one thread wakes up and runs getNextTime()
+    if(at_front)
+    {
+        m_tickled = true;
+    }
+    return at_front;
+}
+
+void TimerManager::rearmTimer(const std::shared_ptr<Timer>& timer)
+{
+    bool at_front = false;
+    {
+        std::unique_lock<std::shared_mutex> write_lock(m_mutex);
+        timer->m_running = false;
+        // 执行期间被取消
+        if(!timer->isActive())
+        {
+            return;
+        }
+        at_front = insertTimer(timer);
+    }
+
+    if(at_front)
+    {
+        onTimerInsertedAtFront();
+    }
+}
+
 bool TimerManager::detectClockRollover() 
 {
     bool rollover = false;   //标识是否检测到时钟回转
@@ -9,6 +9,8 @@
 #include <functional>
 #include <mutex>
 
+#include "inplace_function.h"
+
 namespace sylar {
 
 class TimerManager;
@@ -25,7 +27,10 @@ public:
     bool reset(uint64_t ms, bool from_now);
 
 private:
-    Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager);
+    Timer(uint64_t ms, Callback cb, bool recurring, TimerManager* manager);
+
+    // 是否还未取消（一次性timer触发后也视为取消）
+    bool isActive() const {return m_cb || m_recurringCb;}
  
 private:
     // 是否循环
@@ -34,8 +39,13 @@ private:
     uint64_t m_ms = 0;
     // 绝对超时时间
     std::chrono::time_point<std::chrono::system_clock> m_next;
-    // 超时时触发的回调函数
-    std::function<void()> m_cb;
+    // 超时时触发的回调函数（一次性timer），触发时被移出
+    Callback m_cb;
+    // 循环timer的回调：Callback不能拷贝 -> 每次超时交出的任务共享同一个对象，cancel()时任务仍持有它
+    // 上一次执行返回后才重新加入时间堆 -> 同一时刻最多只有一个线程在执行它
+    std::shared_ptr<Callback> m_recurringCb;
+    // 循环timer的回调正在执行（不在时间堆中），由管理器的锁保护
+    bool m_running = false;
     // 管理此timer的管理器
     TimerManager* m_manager = nullptr;
 
@@ -55,16 +65,28 @@ public:
     virtual ~TimerManager();
 
     // 添加timer
-    std::shared_ptr<Timer> addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false);
+    std::shared_ptr<Timer> addTimer(uint64_t ms, Callback cb, bool recurring = false);
 
-    // 添加条件timer
-    std::shared_ptr<Timer> addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring = false);
+    // 添加条件timer：超时执行时weak_cond仍然存在才调用cb
+    // 模板 -> 包装后的lambda只比cb大一个weak_ptr，cb不超过48字节时仍然不需要分配内存
+    template<class F>
+    std::shared_ptr<Timer> addConditionTimer(uint64_t ms, F cb, std::weak_ptr<void> weak_cond, bool recurring = false)
+    {
+        return addTimer(ms, [weak_cond, cb = std::move(cb)]() mutable
+        {
+            std::shared_ptr<void> tmp = weak_cond.lock();
+            if(tmp)
+            {
+                cb();
+            }
+        }, recurring);
+    }
 
     // 拿到堆中最近的超时时间
     uint64_t getNextTimer();
 
     // 取出所有超时定时器的回调函数
-    void listExpiredCb(std::vector<std::function<void()>>& cbs);
+    void listExpiredCb(std::vector<Callback>& cbs);
 
     // 堆中是否有timer
     bool hasTimer();
@@ -76,6 +98,12 @@ protected:
     // 添加timer
     void addTimer(std::shared_ptr<Timer> timer);
 
+private:
+    // 持有写锁时插入timer，返回是否需要调用onTimerInsertedAtFront()
+    bool insertTimer(const std::shared_ptr<Timer>& timer);
+    // 循环timer的回调执行完毕 -> 仍未取消时重新加入时间堆
+    void rearmTimer(const std::shared_ptr<Timer>& timer);
+
 private:
     // 当系统时间改变时 -> 调用该函数，检测时间是否回转（倒退）
     bool detectClockRollover();
@@ -0,0 +1,345 @@
+#include "trace.h"
+#include "fiber.h"
+#include "thread.h"
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+
+namespace sylar {
+
+std::atomic<bool> Tracer::s_enabled{false};
+std::atomic<uint32_t> Tracer::s_sampleEvery{1};
+
+namespace {
+
+// 一条事件：导出线程可能和写入线程同时访问同一条，所以字段都是relaxed原子变量（x86上就是普通读写）
+struct TraceRecord
+{
+	std::atomic<uint64_t> ts;
+	std::atomic<uint64_t> id;
+	std::atomic<uint64_t> arg;
+	// type | sub << 8
+	std::atomic<uint64_t> info;
+};
+
+// 一个线程的环形缓冲区，只由所属线程写入，写满后覆盖最早的事件
+struct TraceRing
+{
+	// 所属的记录（Start()的次数），由s_ringsMutex保护
+	uint64_t gen = 0;
+	pid_t tid = 0;
+	std::string threadName;
+	size_t mask = 0;
+	std::unique_ptr<TraceRecord[]> records;
+	// 已写入的事件总数
+	std::atomic<uint64_t> head{0};
+	std::atomic<bool> exited{false};
+};
+
+std::mutex s_ringsMutex;
+std::vector<TraceRing*> s_rings;
+std::atomic<uint64_t> s_gen{0};
+size_t s_ringSize = 1 << 16;
+
+thread_local TraceRing* t_ring = nullptr;
+// 线程退出（thread_local析构）之后不再记录
+thread_local bool t_detached = false;
+
+// 线程退出时标记它的缓冲区：已记录的事件仍然可以导出，下一次Start()时释放
+struct RingHolder
+{
+	TraceRing* ring = nullptr;
+
+	~RingHolder()
+	{
+		t_detached = true;
+		if(ring)
+		{
+			ring->exited.store(true, std::memory_order_release);
+		}
+	}
+};
+
+thread_local RingHolder t_holder;
+
+// 为当前线程准备本次记录的缓冲区
+TraceRing* AttachRing()
+{
+	std::lock_guard<std::mutex> lock(s_ringsMutex);
+	TraceRing* ring = t_ring;
+	if(!ring)
+	{
+		ring = new TraceRing;
+		ring->tid = Thread::GetThreadId();
+		s_rings.push_back(ring);
+		t_holder.ring = ring;
+	}
+	if(!ring->records || ring->mask + 1 != s_ringSize)
+	{
+		ring->records.reset(new TraceRecord[s_ringSize]());
+		ring->mask = s_ringSize - 1;
+	}
+	ring->threadName = Thread::GetName();
+	ring->head.store(0, std::memory_order_relaxed);
+	ring->gen = s_gen.load(std::memory_order_relaxed);
+	t_ring = ring;
+	return ring;
+}
+
+struct TraceEvent
+{
+	uint64_t ts;
+	uint64_t id;
+	uint64_t arg;
+	uint32_t type;
+	uint32_t sub;
+	pid_t tid;
+};
+
+std::string JsonEscape(const std::string& s)
+{
+	std::string rt;
+	for(char c : s)
+	{
+		if(c == '"' || c == '\\')
+		{
+			rt += '\\';
+		}
+		rt += c;
+	}
+	return rt;
+}
+
+const char* EventName(uint32_t e)
+{
+	// IOManager::Event
+	return e == 0x1 ? "READ" : (e == 0x4 ? "WRITE" : "NONE");
+}
+
+}
+
+void Tracer::Start(uint32_t sample_every, size_t ring_size)
+{
+	size_t size = 1;
+	while(size < ring_size)
+	{
+		size <<= 1;
+	}
+
+	std::lock_guard<std::mutex> lock(s_ringsMutex);
+	// 已退出线程的缓冲区不会再被写入 -> 释放
+	auto it = std::remove_if(s_rings.begin(), s_rings.end(), [](TraceRing* ring) {
+		if(ring->exited.load(std::memory_order_acquire))
+		{
+			delete ring;
+			return true;
+		}
+		return false;
+	});
+	s_rings.erase(it, s_rings.end());
+
+	s_ringSize = size;
+	s_sampleEvery.store(sample_every ? sample_every : 1, std::memory_order_relaxed);
+	// 各线程下一次记录时发现记录序号变化，清空自己的缓冲区
+	s_gen.fetch_add(1, std::memory_order_release);
+	s_enabled.store(true, std::memory_order_release);
+}
+
+void Tracer::Stop()
+{
+	s_enabled.store(false, std::memory_order_release);
+}
+
+void Tracer::Record(Type type, uint64_t id, uint64_t arg, uint32_t sub, uint64_t ts)
+{
+	if(t_detached)
+	{
+		return;
+	}
+	TraceRing* ring = t_ring;
+	if(!ring || ring->gen != s_gen.load(std::memory_order_acquire))
+	{
+		ring = AttachRing();
+	}
+
+	uint64_t h = ring->head.load(std::memory_order_relaxed);
+	TraceRecord& r = ring->records[h & ring->mask];
+	r.ts.store(ts ? ts : Fiber::Ticks(), std::memory_order_relaxed);
+	r.id.store(id, std::memory_order_relaxed);
+	r.arg.store(arg, std::memory_order_relaxed);
+	r.info.store(type | (uint64_t)sub << 8, std::memory_order_relaxed);
+	ring->head.store(h + 1, std::memory_order_release);
+}
+
+void Tracer::WriteChromeTrace(std::ostream& os)
+{
+	std::vector<TraceEvent> events;
+	std::vector<std::pair<pid_t, std::string>> threads;
+	{
+		std::lock_guard<std::mutex> lock(s_ringsMutex);
+		uint64_t gen = s_gen.load(std::memory_order_relaxed);
+		for(TraceRing* ring : s_rings)
+		{
+			if(ring->gen != gen || !ring->records)
+			{
+				continue;
+			}
+			uint64_t size = ring->mask + 1;
+			uint64_t h = ring->head.load(std::memory_order_acquire);
+			uint64_t begin = h > size ? h - size : 0;
+			size_t first = events.size();
+			for(uint64_t i = begin; i < h; i++)
+			{
+				const TraceRecord& r = ring->records[i & ring->mask];
+				uint64_t info = r.info.load(std::memory_order_relaxed);
+				events.push_back({r.ts.load(std::memory_order_relaxed), r.id.load(std::memory_order_relaxed),
+					r.arg.load(std::memory_order_relaxed), (uint32_t)(info & 0xff), (uint32_t)(info >> 8), ring->tid});
+			}
+			// 读取期间写入线程可能已经覆盖了最早的几条 -> 丢弃下标不大于head-size的事件
+			std::atomic_thread_fence(std::memory_order_acquire);
+			uint64_t h2 = ring->head.load(std::memory_order_relaxed);
+			uint64_t drop = h2 + 1 > begin + size ? std::min(h2 + 1 - begin - size, h - begin) : 0;
+			events.erase(events.begin() + first, events.begin() + first + drop);
+			if(h > 0)
+			{
+				threads.emplace_back(ring->tid, ring->threadName);
+			}
+		}
+	}
+
+	// EPOLL_WAIT记录在等待结束时，时间为等待开始 -> 按时间重新排序
+	std::stable_sort(events.begin(), events.end(), [](const TraceEvent& a, const TraceEvent& b) {return a.ts < b.ts;});
+
+	int pid = getpid();
+	uint64_t base = events.empty() ? 0 : events.front().ts;
+	auto us = [base](uint64_t ts) {return Fiber::TicksToNs(ts - base) / 1000.0;};
+	uint32_t sample_every = s_sampleEvery.load(std::memory_order_relaxed);
+
+	os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+	bool comma = false;
+	auto begin_event = [&os, &comma, pid](const char* ph, const std::string& name, pid_t tid, double ts) {
+		os << (comma ? ",\n" : "") << "{\"ph\":\"" << ph << "\",\"name\":\"" << JsonEscape(name) << "\",\"pid\":" << pid
+		   << ",\"tid\":" << tid << ",\"ts\":" << ts;
+		comma = true;
+	};
+	os.setf(std::ios::fixed);
+	os.precision(3);
+
+	for(auto& i : threads)
+	{
+		begin_event("M", "thread_name", i.first, 0);
+		os << ",\"args\":{\"name\":\"" << JsonEscape(i.second) << "\"}}";
+	}
+
+	// 协程函数的名字，来自FIBER_START
+	std::unordered_map<uint64_t, std::string> names;
+	// 每个线程上正在运行的（被跟踪的）协程
+	struct Slice
+	{
+		uint64_t fiber;
+		uint64_t start;
+	};
+	std::unordered_map<pid_t, Slice> running;
+	// 放入任务队列到开始运行之间的箭头
+	std::unordered_map<uint64_t, uint64_t> flows;
+	uint64_t next_flow = 1;
+
+	auto close_slice = [&](pid_t tid, uint64_t ts, const char* yield) {
+		auto it = running.find(tid);
+		if(it == running.end())
+		{
+			return;
+		}
+		uint64_t fiber = it->second.fiber;
+		auto name = names.find(fiber);
+		begin_event("X", name != names.end() ? name->second : "fiber " + std::to_string(fiber), tid, us(it->second.start));
+		os << ",\"dur\":" << us(ts) - us(it->second.start) << ",\"cat\":\"fiber\",\"args\":{\"fiber\":" << fiber;
+		if(yield)
+		{
+			os << ",\"yield\":\"" << yield << "\"";
+		}
+		os << "}}";
+		running.erase(it);
+	};
+
+	for(const TraceEvent& e : events)
+	{
+		switch(e.type)
+		{
+		case SWITCH:
+		{
+			auto it = running.find(e.tid);
+			bool from_running = it != running.end() && it->second.fiber == e.arg;
+			close_slice(e.tid, e.ts, from_running ? Fiber::WaitStateName((Fiber::WaitState)e.sub) : nullptr);
+			if(e.id % sample_every == 0)
+			{
+				running[e.tid] = {e.id, e.ts};
+				auto flow = flows.find(e.id);
+				if(flow != flows.end())
+				{
+					begin_event("f", "wakeup", e.tid, us(e.ts));
+					os << ",\"cat\":\"sched\",\"bp\":\"e\",\"id\":" << flow->second << "}";
+					flows.erase(flow);
+				}
+			}
+			break;
+		}
+		case FIBER_START:
+			names[e.id] = Fiber::EntryName((const std::type_info*)e.arg);
+			break;
+		case SCHEDULE:
+			begin_event("i", "schedule", e.tid, us(e.ts));
+			os << ",\"s\":\"t\",\"cat\":\"sched\",\"args\":{\"fiber\":" << e.id << ",\"thread\":" << (int64_t)e.arg << "}}";
+			begin_event("s", "wakeup", e.tid, us(e.ts));
+			os << ",\"cat\":\"sched\",\"id\":" << next_flow << "}";
+			flows[e.id] = next_flow++;
+			break;
+		case ADD_EVENT:
+			begin_event("i", "wait fd", e.tid, us(e.ts));
+			os << ",\"s\":\"t\",\"cat\":\"io\",\"args\":{\"fiber\":" << e.id << ",\"fd\":" << e.arg << ",\"event\":\"" << EventName(e.sub) << "\"}}";
+			break;
+		case TRIGGER:
+			begin_event("i", "trigger fd", e.tid, us(e.ts));
+			os << ",\"s\":\"t\",\"cat\":\"io\",\"args\":{\"fiber\":" << e.id << ",\"fd\":" << e.arg << ",\"event\":\"" << EventName(e.sub) << "\"}}";
+			break;
+		case TIMER_FIRE:
+			begin_event("i", "timers", e.tid, us(e.ts));
+			os << ",\"s\":\"t\",\"cat\":\"timer\",\"args\":{\"count\":" << e.arg << "}}";
+			break;
+		case TICKLE:
+			begin_event("i", "tickle", e.tid, us(e.ts));
+			os << ",\"s\":\"t\",\"cat\":\"sched\"}";
+			break;
+		case EPOLL_WAIT:
+			begin_event("X", "epoll_wait", e.tid, us(e.ts));
+			os << ",\"dur\":" << us(e.ts + e.arg) - us(e.ts) << ",\"cat\":\"io\",\"args\":{\"events\":" << e.id << "}}";
+			break;
+		}
+	}
+
+	// 导出时仍在运行的协程
+	uint64_t end = events.empty() ? 0 : events.back().ts;
+	while(!running.empty())
+	{
+		close_slice(running.begin()->first, end, nullptr);
+	}
+	os << "\n]}\n";
+}
+
+bool Tracer::WriteChromeTrace(const std::string& path)
+{
+	std::ofstream ofs(path);
+	if(!ofs)
+	{
+		return false;
+	}
+	WriteChromeTrace(ofs);
+	return ofs.good();
+}
+
+}
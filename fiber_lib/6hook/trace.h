@@ -0,0 +1,62 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace sylar {
+
+// 协程调度的事件跟踪，用于定位尾延迟：哪个协程在哪个线程上运行、在哪个fd上挂起、idle何时被唤醒
+// 默认关闭，关闭时每个记录点只多一次原子变量读取；Start()后每个线程把事件写入自己的环形缓冲区（无锁，只保留最近的事件），
+// WriteChromeTrace()导出为Chrome trace JSON，可以用chrome://tracing或ui.perfetto.dev打开
+class Tracer
+{
+public:
+	// 事件类型，id、arg、sub的含义见各项说明
+	enum Type
+	{
+		// 线程从协程arg切换到协程id，sub为arg挂起时的等待状态（Fiber::WaitState）
+		SWITCH = 1,
+		// 协程id开始执行协程函数，arg为函数类型（const std::type_info*）
+		FIBER_START,
+		// 协程id被放入任务队列，arg为指定的线程（-1表示任意）
+		SCHEDULE,
+		// 协程id在fd arg上等待事件sub（IOManager::Event）
+		ADD_EVENT,
+		// fd arg上的事件sub被触发，唤醒协程id（回调为0）
+		TRIGGER,
+		// idle取出了arg个到期的定时器
+		TIMER_FIRE,
+		// 写入tickle管道唤醒idle线程
+		TICKLE,
+		// 从记录时刻开始阻塞在epoll_wait中arg个时钟周期，返回id个事件
+		EPOLL_WAIT
+	};
+
+	// 开始记录（已在记录时重新开始，清空之前的事件）
+	// sample_every：只跟踪id能被它整除的协程（不属于某个协程的事件总是记录）；ring_size：每个线程保留的最近事件数，向上取整为2的幂
+	static void Start(uint32_t sample_every = 1, size_t ring_size = 1 << 16);
+	// 停止记录，已记录的事件保留到下一次Start()
+	static void Stop();
+
+	static bool Enabled() {return s_enabled.load(std::memory_order_relaxed);}
+	// 是否跟踪协程fiber_id
+	static bool Sampled(uint64_t fiber_id) {return fiber_id % s_sampleEvery.load(std::memory_order_relaxed) == 0;}
+
+	// 由各记录点在Enabled()时调用，ts为0表示当前时刻
+	static void Record(Type type, uint64_t id, uint64_t arg, uint32_t sub = 0, uint64_t ts = 0);
+
+	// 把本次记录的事件写成Chrome trace JSON；最好在Stop()之后调用，记录期间导出时正被覆盖的事件会被丢弃
+	static void WriteChromeTrace(std::ostream& os);
+	static bool WriteChromeTrace(const std::string& path);
+
+private:
+	static std::atomic<bool> s_enabled;
+	static std::atomic<uint32_t> s_sampleEvery;
+};
+
+}
+
+#endif
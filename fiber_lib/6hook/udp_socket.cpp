@@ -0,0 +1,177 @@
+#include "udp_socket.h"
+#include "hook.h"
+
+#include <iostream>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <netinet/udp.h>
+
+static bool debug = false;
+
+namespace sylar {
+
+// 每个消息的控制信息缓冲区，只用于接收UDP_GRO的分段大小
+static const size_t CONTROL_SIZE = CMSG_SPACE(sizeof(int));
+
+UdpSocket::UdpSocket(int family, size_t batch, size_t buffer_size):
+m_batch(batch), m_bufferSize(buffer_size)
+{
+	assert(batch > 0 && buffer_size > 0);
+
+	// hook后的socket -> 由FdMgr管理，等待时挂起协程
+	m_fd = socket(family, SOCK_DGRAM, 0);
+	if(m_fd == -1)
+	{
+		std::cerr << "UdpSocket() socket failed: " << strerror(errno) << std::endl;
+	}
+
+	m_buffers.reset(new char[m_batch * m_bufferSize]);
+	m_msgs.resize(m_batch);
+	m_iovs.resize(m_batch);
+	m_addrs.resize(m_batch);
+	m_controls.resize(m_batch * CONTROL_SIZE);
+	for(size_t i = 0; i < m_batch; i++)
+	{
+		m_iovs[i].iov_base = m_buffers.get() + i * m_bufferSize;
+		m_iovs[i].iov_len  = m_bufferSize;
+	}
+}
+
+UdpSocket::~UdpSocket()
+{
+	if(m_fd != -1)
+	{
+		close(m_fd);
+	}
+}
+
+int UdpSocket::bind(const sockaddr* addr, socklen_t addrlen)
+{
+	return ::bind(m_fd, addr, addrlen);
+}
+
+int UdpSocket::connect(const sockaddr* addr, socklen_t addrlen)
+{
+	return ::connect(m_fd, addr, addrlen);
+}
+
+bool UdpSocket::enableGro()
+{
+	int one = 1;
+	if(setsockopt(m_fd, SOL_UDP, UDP_GRO, &one, sizeof(one)))
+	{
+		if(debug) std::cout << "UdpSocket::enableGro() failed: " << strerror(errno) << std::endl;
+		return false;
+	}
+	m_gro = true;
+	return true;
+}
+
+bool UdpSocket::setGsoSize(uint16_t segment_size)
+{
+	int size = segment_size;
+	if(setsockopt(m_fd, SOL_UDP, UDP_SEGMENT, &size, sizeof(size)))
+	{
+		if(debug) std::cout << "UdpSocket::setGsoSize() failed: " << strerror(errno) << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int UdpSocket::recv(std::vector<Datagram>& datagrams)
+{
+	datagrams.clear();
+
+	// 内核会修改地址和控制信息的长度 -> 每次重新设置
+	for(size_t i = 0; i < m_batch; i++)
+	{
+		msghdr& hdr = m_msgs[i].msg_hdr;
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.msg_name    = &m_addrs[i];
+		hdr.msg_namelen = sizeof(sockaddr_storage);
+		hdr.msg_iov     = &m_iovs[i];
+		hdr.msg_iovlen  = 1;
+		if(m_gro)
+		{
+			hdr.msg_control    = &m_controls[i * CONTROL_SIZE];
+			hdr.msg_controllen = CONTROL_SIZE;
+		}
+		m_msgs[i].msg_len = 0;
+	}
+
+	// 没有数据时挂起，唤醒后一次取出所有已到达的数据报
+	int n = recvmmsg(m_fd, m_msgs.data(), m_batch, 0, nullptr);
+	if(n <= 0)
+	{
+		return n;
+	}
+
+	for(int i = 0; i < n; i++)
+	{
+		msghdr& hdr = m_msgs[i].msg_hdr;
+		const char* data = (const char*)m_iovs[i].iov_base;
+		size_t len = m_msgs[i].msg_len;
+
+		// GRO合并的数据报：除最后一个外长度都是segment
+		size_t segment = len;
+		if(m_gro)
+		{
+			for(cmsghdr* cm = CMSG_FIRSTHDR(&hdr); cm; cm = CMSG_NXTHDR(&hdr, cm))
+			{
+				if(cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO)
+				{
+					int gso_size;
+					memcpy(&gso_size, CMSG_DATA(cm), sizeof(gso_size));
+					segment = gso_size > 0 ? gso_size : len;
+				}
+			}
+		}
+
+		size_t offset = 0;
+		do
+		{
+			Datagram dg;
+			dg.data    = data + offset;
+			dg.size    = std::min(segment, len - offset);
+			dg.addr    = (const sockaddr*)&m_addrs[i];
+			dg.addrlen = hdr.msg_namelen;
+			datagrams.push_back(dg);
+			offset += dg.size;
+		} while(offset < len);
+	}
+	return datagrams.size();
+}
+
+int UdpSocket::send(const Datagram* datagrams, size_t count)
+{
+	std::vector<mmsghdr> msgs(count);
+	std::vector<iovec> iovs(count);
+	for(size_t i = 0; i < count; i++)
+	{
+		iovs[i].iov_base = (void*)datagrams[i].data;
+		iovs[i].iov_len  = datagrams[i].size;
+
+		msghdr& hdr = msgs[i].msg_hdr;
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.msg_name    = (void*)datagrams[i].addr;
+		hdr.msg_namelen = datagrams[i].addrlen;
+		hdr.msg_iov     = &iovs[i];
+		hdr.msg_iovlen  = 1;
+	}
+
+	// sendmmsg可能只发送了一部分 -> 继续发送剩余的
+	size_t sent = 0;
+	while(sent < count)
+	{
+		int n = sendmmsg(m_fd, msgs.data() + sent, count - sent, 0);
+		if(n < 0)
+		{
+			return sent ? (int)sent : -1;
+		}
+		sent += n;
+	}
+	return sent;
+}
+
+}
@@ -0,0 +1,63 @@
+#ifndef _UDP_SOCKET_H_
+#define _UDP_SOCKET_H_
+
+#include <vector>
+#include <memory>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+namespace sylar {
+
+// 批量收发的UDP socket：每次唤醒用一次recvmmsg取出最多batch个数据报，发送时用sendmmsg合并系统调用
+// 可选开启UDP_GRO（接收时内核合并同流数据报）和UDP_SEGMENT（发送时由内核/网卡切分大缓冲区）
+// 只能在启用hook的协程中使用，等待数据时挂起当前协程
+class UdpSocket
+{
+public:
+	// 一个数据报，data指向内部缓冲区，在下一次recv()之前有效
+	struct Datagram
+	{
+		const char* data = nullptr;
+		size_t size = 0;
+		const sockaddr* addr = nullptr;
+		socklen_t addrlen = 0;
+	};
+
+	// batch: 一次最多接收的数据报个数，buffer_size: 每个数据报的缓冲区大小，开启GRO时应为65535
+	UdpSocket(int family = AF_INET, size_t batch = 64, size_t buffer_size = 2048);
+	~UdpSocket();
+
+	int getFd() const {return m_fd;}
+
+	int bind(const sockaddr* addr, socklen_t addrlen);
+	int connect(const sockaddr* addr, socklen_t addrlen);
+
+	// 开启UDP_GRO：一次接收的缓冲区可能包含多个等长的数据报，recv()会把它们拆开
+	bool enableGro();
+	// 设置UDP_SEGMENT：之后发送的大缓冲区按segment_size切分成多个数据报，0表示关闭
+	bool setGsoSize(uint16_t segment_size);
+
+	// 挂起直到至少收到一个数据报，然后一次取出所有已到达的（最多batch个）
+	// 返回数据报个数，失败返回-1
+	int recv(std::vector<Datagram>& datagrams);
+
+	// 发送count个数据报，返回成功发送的个数，失败返回-1
+	int send(const Datagram* datagrams, size_t count);
+
+private:
+	int m_fd = -1;
+	size_t m_batch;
+	size_t m_bufferSize;
+	bool m_gro = false;
+
+	// recvmmsg使用的缓冲区，按batch预先分配
+	std::unique_ptr<char[]> m_buffers;
+	std::vector<mmsghdr> m_msgs;
+	std::vector<iovec> m_iovs;
+	std::vector<sockaddr_storage> m_addrs;
+	std::vector<char> m_controls;
+};
+
+}
+
+#endif